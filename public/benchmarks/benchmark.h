@@ -0,0 +1,121 @@
+#ifndef PUBLIC_BENCHMARKS_BENCHMARK_H_
+#define PUBLIC_BENCHMARKS_BENCHMARK_H_
+
+#include <unistd.h>
+
+#include "timer.h"
+#include "util.h"
+
+// benchmark的公共部分: 自动确定迭代次数, 汇总结果写成json, 用于比较不同
+// 版本之间的性能变化. 每个benchmark是一个单独的可执行文件, make bench
+// 依次运行它们, 结果写到build/bench/<文件名>.json:
+//   BenchmarkReport report("queue");
+//   report.Run("push_pop", {{"threads", 4}}, [&](int64_t iterations) {
+//     for (int64_t i = 0; i < iterations; ++i) { ... }
+//   });
+//   report.Save(FLAGS_output);
+// 输出格式:
+//   {"suite": "queue", "date": "...", "host": "...", "compiler": "...",
+//    "results": [{"name": "push_pop", "params": {"threads": 4},
+//                 "iterations": 1048576, "ns_per_op": 85.3,
+//                 "ops_per_second": 11723329.4}, ...]}
+// 同一个suite中name + params唯一确定一项结果, 比较工具据此对齐.
+
+using BenchmarkParams = std::vector<std::pair<std::string, Json::Value>>;
+
+class BenchmarkReport {
+ public:
+  explicit BenchmarkReport(const std::string& suite, double min_seconds = 0.2);
+  DISABLE_COPY_ASIGN(BenchmarkReport);
+  DISABLE_MOVE_ASIGN(BenchmarkReport);
+  ~BenchmarkReport() = default;
+
+  // 反复调用function(iterations), 迭代次数逐步放大, 直到一轮的耗时超过
+  // min_seconds, 用最后一轮计算每次操作的耗时. 返回这一项结果, 可以继续
+  // 添加其他指标, 比如延迟的分位数.
+  template <class F>
+  Json::Value& Run(const std::string& name, const BenchmarkParams& params,
+                   F function);
+
+  // 直接添加测量好的结果, 比如只运行一次的大文件读取
+  Json::Value& Add(const std::string& name, const BenchmarkParams& params,
+                   int64_t iterations, double seconds);
+
+  const Json::Value& root() const { return root_; }
+  // file为空时不写文件, 结果只打印在日志中
+  void Save(const std::string& file) const;
+
+ private:
+  double min_seconds_;
+  Json::Value root_;
+};
+
+// 让编译器认为value被使用了, 防止被测的计算被优化掉
+template <class T> inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+//////////////////////////////// implementation ////////////////////////////////
+
+inline BenchmarkReport::BenchmarkReport(const std::string& suite,
+                                        double min_seconds)
+    : min_seconds_(min_seconds) {
+  char host[256] = {};
+  gethostname(host, sizeof(host) - 1);
+  root_["suite"] = suite;
+  root_["date"] = DateTime().string().substr(0, 19);
+  root_["host"] = host;
+  root_["compiler"] = __VERSION__;
+  root_["hardware_threads"] = int(std::thread::hardware_concurrency());
+  root_["results"] = Json::Value(Json::arrayValue);
+}
+
+template <class F>
+Json::Value& BenchmarkReport::Run(const std::string& name,
+                                  const BenchmarkParams& params, F function) {
+  const int64_t kMaxIterations = int64_t(1) << 40;
+  int64_t iterations = 1;
+  while (true) {
+    Timer timer;
+    timer.Start();
+    function(iterations);
+    double seconds = timer.Seconds();
+    if (seconds >= min_seconds_ || iterations >= kMaxIterations) {
+      return this->Add(name, params, iterations, seconds);
+    }
+    // 按这一轮的耗时估算, 多留一些余量, 每次最多放大10倍
+    auto next = iterations * 10;
+    if (seconds > 0) {
+      next = std::min(next, int64_t(iterations * min_seconds_ * 1.4 / seconds));
+    }
+    iterations = std::max(next, iterations + 1);
+  }
+}
+
+inline Json::Value& BenchmarkReport::Add(const std::string& name,
+                                         const BenchmarkParams& params,
+                                         int64_t iterations, double seconds) {
+  Json::Value result;
+  result["name"] = name;
+  result["params"] = Json::Value(Json::objectValue);
+  std::string label = name;
+  for (const auto& pair : params) {
+    result["params"][pair.first] = pair.second;
+    label += " " + pair.first + "=" + pair.second.asString();
+  }
+  double ns_per_op = seconds * 1e9 / double(std::max<int64_t>(iterations, 1));
+  result["iterations"] = Json::Int64(iterations);
+  result["ns_per_op"] = ns_per_op;
+  result["ops_per_second"] = ns_per_op > 0 ? 1e9 / ns_per_op : 0.0;
+  LOG(INFO) << boost::format("%-48s %12.1f ns/op %14.1f ops/s") % label %
+                   ns_per_op % result["ops_per_second"].asDouble();
+  return root_["results"].append(result);
+}
+
+inline void BenchmarkReport::Save(const std::string& file) const {
+  if (file.empty()) { return; }
+  WriteJsonFile(root_, file);
+  LOG(INFO) << "benchmark results written to " << file;
+}
+
+#endif  // PUBLIC_BENCHMARKS_BENCHMARK_H_
@@ -0,0 +1,90 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "benchmark.h"
+#include "blocking_queue.h"
+#include "ring_queue.h"
+
+// 多生产者多消费者的吞吐量, 每次操作是一个元素从push到被pop的过程.
+// single: BlockingQueue逐个push/pop; batch: push_many/pop_many;
+// ring: 无锁的RingQueue, 作为对照.
+
+DEFINE_string(output, "", "write results as json to this file");
+DEFINE_int32(capacity, 1024, "queue capacity");
+DEFINE_int32(batch, 64, "items per push_many/pop_many");
+
+// 启动producers个生产者和consumers个消费者, 一共传递iterations个元素
+template <class Push, class Pop>
+static void RunProducersConsumers(int64_t iterations, int producers,
+                                  int consumers, Push push, Pop pop) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < producers; ++i) {
+    // 前面的生产者多分担余数
+    int64_t count = iterations / producers + (i < iterations % producers);
+    threads.emplace_back([count, &push] { push(count); });
+  }
+  for (int i = 0; i < consumers; ++i) {
+    int64_t count = iterations / consumers + (i < iterations % consumers);
+    threads.emplace_back([count, &pop] { pop(count); });
+  }
+  for (auto& thread : threads) { thread.join(); }
+}
+
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  google::LogToStderr();
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  BenchmarkReport report("blocking_queue");
+  const std::vector<std::pair<int, int>> shapes = {{1, 1}, {2, 2}, {4, 4},
+                                                   {8, 1}, {1, 8}};
+  for (const auto& shape : shapes) {
+    const BenchmarkParams params = {{"producers", shape.first},
+                                    {"consumers", shape.second}};
+    report.Run("single", params, [&](int64_t iterations) {
+      BlockingQueue<int64_t> queue(FLAGS_capacity);
+      auto push = [&queue](int64_t count) {
+        for (int64_t i = 0; i < count; ++i) { queue.push(i); }
+      };
+      auto pop = [&queue](int64_t count) {
+        int64_t value = 0;
+        for (int64_t i = 0; i < count; ++i) { queue.pop(value); }
+      };
+      RunProducersConsumers(iterations, shape.first, shape.second, push, pop);
+    });
+
+    report.Run("batch", params, [&](int64_t iterations) {
+      BlockingQueue<int64_t> queue(FLAGS_capacity);
+      auto push = [&queue](int64_t count) {
+        std::vector<int64_t> batch(FLAGS_batch);
+        for (int64_t i = 0; i < count; i += FLAGS_batch) {
+          auto size = std::min<int64_t>(FLAGS_batch, count - i);
+          queue.push_many(batch.begin(), batch.begin() + size);
+        }
+      };
+      auto pop = [&queue](int64_t count) {
+        std::vector<int64_t> batch;
+        batch.reserve(FLAGS_batch);
+        for (int64_t i = 0; i < count; i += int64_t(batch.size())) {
+          batch.clear();
+          queue.pop_many(batch, int(std::min<int64_t>(FLAGS_batch, count - i)));
+        }
+      };
+      RunProducersConsumers(iterations, shape.first, shape.second, push, pop);
+    });
+
+    report.Run("ring", params, [&](int64_t iterations) {
+      RingQueue<int64_t> queue(FLAGS_capacity);
+      auto push = [&queue](int64_t count) {
+        for (int64_t i = 0; i < count; ++i) { queue.push(i); }
+      };
+      auto pop = [&queue](int64_t count) {
+        int64_t value = 0;
+        for (int64_t i = 0; i < count; ++i) { queue.pop(value); }
+      };
+      RunProducersConsumers(iterations, shape.first, shape.second, push, pop);
+    });
+  }
+  report.Save(FLAGS_output);
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "benchmark.h"
+
+// 比较DateTime的格式化/解析与直接使用date库+stringstream的开销.
+// 时间戳间隔step_us微秒递增, 模拟给连续的记录打时间戳.
+
+DEFINE_string(output, "", "write results as json to this file");
+DEFINE_int32(num_values, 200000, "number of distinct timestamps");
+DEFINE_int32(step_us, 37, "microseconds between consecutive timestamps");
+
+static std::string LegacyString(const DateTime& time) {
+  std::stringstream ss;
+  auto zoned = date::make_zoned(date::current_zone(), time.value);
+  date::to_stream(ss, "%Y-%m-%d %H:%M:%S", zoned);
+  return ss.str();
+}
+
+static DateTime LegacyParse(const std::string& content) {
+  date::local_time<DateTime::Duration> local_time;
+  std::stringstream ss(content);
+  date::from_stream(ss, "%Y-%m-%d %H:%M:%S", local_time);
+  return DateTime(date::current_zone()->to_sys(local_time));
+}
+
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  google::LogToStderr();
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  const size_t size = size_t(FLAGS_num_values);
+  std::vector<DateTime> values;
+  DateTime start;
+  for (size_t i = 0; i < size; ++i) {
+    auto offset = std::chrono::microseconds(int64_t(i) * FLAGS_step_us);
+    values.emplace_back(start.value + offset);
+  }
+  std::vector<std::string> strings;
+  for (const auto& value : values) { strings.push_back(value.string()); }
+
+  BenchmarkReport report("datetime");
+  report.Run("DateTime::string/legacy", {}, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      DoNotOptimize(LegacyString(values[i % size]));
+    }
+  });
+  report.Run("DateTime::string", {}, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      DoNotOptimize(values[i % size].string());
+    }
+  });
+  char buffer[DateTime::kStringSize];
+  report.Run("DateTime::Format", {}, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      values[i % size].Format(buffer);
+      DoNotOptimize(buffer);
+    }
+  });
+  // 每次操作是格式化一个值
+  Timer timer;
+  timer.Start();
+  auto column = DateTime::FormatColumn(values);
+  report.Add("DateTime::FormatColumn", {}, int64_t(size), timer.Seconds());
+  CHECK_EQ(column.size(), size * (DateTime::kStringSize + 1));
+
+  report.Run("DateTime::Parse/legacy", {}, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      DoNotOptimize(LegacyParse(strings[i % size]).value);
+    }
+  });
+  DateTime parsed;
+  report.Run("DateTime::Parse", {}, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      CHECK(DateTime::Parse(strings[i % size], parsed));
+      DoNotOptimize(parsed.value);
+    }
+  });
+  report.Save(FLAGS_output);
+  return 0;
+}
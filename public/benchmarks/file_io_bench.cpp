@@ -0,0 +1,116 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "benchmark.h"
+#include "util.h"
+
+// 按文件大小统计ReadFile/ReadLines/ReadJsonFile和md5的吞吐量.
+// 测试文件生成在临时目录中, 第一次读取之后都在page cache里, 测的是
+// 解析和拷贝的开销, 而不是磁盘.
+
+DEFINE_string(output, "", "write results as json to this file");
+DEFINE_string(sizes, "4K,1M,16M", "comma separated file sizes");
+DEFINE_int32(threads, 4, "threads for the parallel variants");
+
+// 每行一个整数, 大约size字节
+static std::string MakeLines(int64_t size) {
+  std::string content;
+  content.reserve(size_t(size) + 16);
+  for (int64_t i = 0; int64_t(content.size()) < size; ++i) {
+    AppendString(content, i * 7919 % 1000003);
+    content.push_back('\n');
+  }
+  return content;
+}
+
+// 对象数组, 大约size字节
+static Json::Value MakeJson(int64_t size) {
+  Json::Value root(Json::arrayValue);
+  int64_t bytes = 0;
+  for (int i = 0; bytes < size; ++i) {
+    Json::Value record;
+    record["id"] = i;
+    record["name"] = "record-" + std::to_string(i);
+    record["score"] = i * 0.5;
+    record["tags"].append("benchmark");
+    root.append(record);
+    bytes += 64;
+  }
+  return root;
+}
+
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  google::LogToStderr();
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto dirname = (boost::filesystem::temp_directory_path() /
+                  boost::filesystem::unique_path())
+                     .string();
+  ThreadPool pool(FLAGS_threads);
+  BenchmarkReport report("file_io");
+  std::vector<std::string> sizes;
+  boost::split(sizes, FLAGS_sizes, boost::is_any_of(","));
+  for (const auto& size_string : sizes) {
+    int64_t size = GetBytesByString(size_string);
+    CHECK_GT(size, 0) << "invalid size: " << size_string;
+    const BenchmarkParams params = {{"size", size_string}};
+    auto lines_file = dirname + "/lines_" + size_string + ".txt";
+    auto json_file = dirname + "/json_" + size_string + ".json";
+    auto content = MakeLines(size);
+    CHECK(WriteFile(lines_file, content));
+    WriteJsonFile(MakeJson(size), json_file);
+    auto json_size = GetFileSize(json_file);
+
+    // 附加每秒处理的字节数, 便于不同大小之间比较
+    auto add_throughput = [](Json::Value& result, int64_t bytes) {
+      auto ops = result["ops_per_second"].asDouble();
+      result["bytes_per_second"] = ops * double(bytes);
+    };
+    auto& read = report.Run("ReadFile", params, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; ++i) {
+        CHECK_EQ(ReadFile(lines_file).size(), content.size());
+      }
+    });
+    add_throughput(read, int64_t(content.size()));
+
+    auto& lines = report.Run("ReadLines", params, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; ++i) {
+        CHECK(!ReadLines<int>(lines_file).empty());
+      }
+    });
+    add_throughput(lines, int64_t(content.size()));
+
+    auto& parallel = report.Run(
+        "ReadLines/parallel", params, [&](int64_t iterations) {
+          for (int64_t i = 0; i < iterations; ++i) {
+            CHECK(!ReadLines<int>(lines_file, pool, 1 << 20).empty());
+          }
+        });  // NOFORMAT(-4:)
+    add_throughput(parallel, int64_t(content.size()));
+
+    auto& json = report.Run("ReadJsonFile", params, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; ++i) {
+        CHECK(!ReadJsonFile(json_file).empty());
+      }
+    });
+    add_throughput(json, json_size);
+
+    auto& md5 = report.Run("CalcMD5", params, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; ++i) {
+        CHECK_EQ(CalcMD5(content).size(), 32);
+      }
+    });
+    add_throughput(md5, int64_t(content.size()));
+
+    auto& file_md5 = report.Run("CalcFileMD5", params, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; ++i) {
+        CHECK_EQ(CalcFileMD5(lines_file).size(), 32);
+      }
+    });
+    add_throughput(file_md5, int64_t(content.size()));
+  }
+  boost::filesystem::remove_all(dirname);
+  report.Save(FLAGS_output);
+  return 0;
+}
@@ -0,0 +1,120 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "benchmark.h"
+#include "util.h"
+
+// 比较基于boost::format的旧版ToString/GetBytesString与基于std::to_chars的
+// 新实现. legacy: 旧实现; ToString: 每次返回新的字符串; AppendString:
+// 复用同一个buffer.
+
+DEFINE_string(output, "", "write results as json to this file");
+
+namespace legacy {
+
+inline std::string ToString(int value) {
+  return (boost::format("%d") % value).str();
+}
+
+inline std::string ToString(double value) {
+  return (boost::format("%.2f") % value).str();
+}
+
+template <class T> std::string ToString(const std::vector<T>& values) {
+  std::vector<std::string> string_values;
+  for (size_t i = 0; i < values.size(); ++i) {
+    string_values.push_back(ToString(values[i]));
+  }
+  std::string result = boost::algorithm::join(string_values, ", ");
+  return std::string("[") + result + std::string("]");
+}
+
+std::string GetBytesString(int64_t bytes) {
+  const std::vector<std::pair<std::string, int64_t>> map = {
+    {"GB", 1024*1024*1024},
+    {"MB", 1024*1024},
+    {"KB", 1024},
+    {"B", 1},
+  };  // NOFORMAT(-5:)
+  for (size_t i = 0; i < map.size() - 1; ++i) {
+    if (bytes >= map[i].second) {
+      auto amount = float(bytes) / float(map[i].second);
+      return (boost::format("%.2f %s") % amount % map[i].first).str();
+    }
+  }
+  auto amount = float(bytes) / float(map.back().second);
+  return (boost::format("%.2f %s") % amount % map.back().first).str();
+}
+
+}  // namespace legacy
+
+template <class T>
+static void RunCase(BenchmarkReport& report, const std::string& type,
+                    const T& values) {
+  CHECK_EQ(legacy::ToString(values), ToString(values));
+  const BenchmarkParams params = {{"type", type}};
+  report.Run("ToString/legacy", params, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      DoNotOptimize(legacy::ToString(values));
+    }
+  });
+  report.Run("ToString", params, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      DoNotOptimize(ToString(values));
+    }
+  });
+  std::string buffer;
+  report.Run("AppendString", params, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      buffer.clear();
+      AppendString(buffer, values);
+      DoNotOptimize(buffer);
+    }
+  });
+}
+
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  google::LogToStderr();
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  BenchmarkReport report("format");
+  std::vector<int> ints(64);
+  std::vector<double> doubles(64);
+  for (int i = 0; i < 64; ++i) {
+    ints[i] = i * 7919 - 100000;
+    doubles[i] = i * 3.14159 - 50;
+  }
+  RunCase(report, "vector<int>", ints);
+  RunCase(report, "vector<double>", doubles);
+  RunCase(report, "nested",
+          std::vector<std::vector<int>>(8, {1, 22, 333, 4444}));
+
+  CHECK_EQ(legacy::GetBytesString(123456789), GetBytesString(123456789));
+  report.Run("GetBytesString/legacy", {}, [](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      DoNotOptimize(legacy::GetBytesString(i * 4099));
+    }
+  });
+  report.Run("GetBytesString", {}, [](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      DoNotOptimize(GetBytesString(i * 4099));
+    }
+  });
+  std::string buffer;
+  report.Run("AppendBytesString", {}, [&buffer](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      buffer.clear();
+      AppendBytesString(buffer, i * 4099);
+      DoNotOptimize(buffer);
+    }
+  });
+  const std::vector<std::string> units = {"512b", "1.5k", "32 KB", "0.3G"};
+  report.Run("GetBytesByString", {}, [&units](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; ++i) {
+      DoNotOptimize(GetBytesByString(units[i % units.size()]));
+    }
+  });
+  report.Save(FLAGS_output);
+  return 0;
+}
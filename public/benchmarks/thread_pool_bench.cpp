@@ -0,0 +1,159 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "benchmark.h"
+#include "thread_pool.h"
+
+// 比较ThreadPool两种调度模式在细粒度任务下的吞吐量和延迟.
+// external: 所有任务都由主线程提交, 同时统计从enqueue到开始执行的延迟.
+// nested: 主线程提交少量父任务, 每个父任务在worker内部再提交子任务.
+// allocations: 稳定状态下enqueue和post每个任务的堆内存分配次数.
+
+DEFINE_string(output, "", "write results as json to this file");
+DEFINE_int32(num_tasks, 200000, "number of tasks per run");
+DEFINE_int32(fanout, 64, "number of child tasks per parent in nested runs");
+DEFINE_int32(work, 100, "busy loop iterations per task");
+
+// 替换全局的operator new, 统计堆内存分配次数
+static std::atomic<int64_t> g_allocations{0};
+
+void* operator new(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size)) { return p; }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return ::operator new(size); }
+// 不内联, 否则gcc会把内联后的free与operator new配对, 给出误报
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p) noexcept { ::operator delete(p); }
+void operator delete(void* p, size_t) noexcept { ::operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { ::operator delete(p); }
+
+static void BusyWork(int iterations) {
+  volatile int sink = 0;
+  for (int i = 0; i < iterations; ++i) { sink = sink + i; }
+}
+
+static void RunExternal(BenchmarkReport& report, int num_threads,
+                        ThreadPool::Mode mode, const std::string& mode_name) {
+  LatencyHistogram latency;
+  Timer timer;
+  timer.Start();
+  {
+    ThreadPool pool(num_threads, mode);
+    std::vector<std::future<void>> results;
+    results.reserve(FLAGS_num_tasks);
+    for (int i = 0; i < FLAGS_num_tasks; ++i) {
+      auto enqueued = std::chrono::steady_clock::now();
+      results.push_back(pool.enqueue([&latency, enqueued] {
+        latency.Record(std::chrono::steady_clock::now() - enqueued);
+        BusyWork(FLAGS_work);
+      }));
+    }
+    for (auto& result : results) { result.get(); }
+  }
+  auto& result =
+      report.Add("enqueue", {{"threads", num_threads}, {"mode", mode_name}},
+                 FLAGS_num_tasks, timer.Seconds());
+  result["latency"] = latency.ToJson();
+}
+
+static void RunNested(BenchmarkReport& report, int num_threads,
+                      ThreadPool::Mode mode, const std::string& mode_name) {
+  std::atomic<int> remaining{FLAGS_num_tasks / FLAGS_fanout * FLAGS_fanout};
+  std::promise<void> done;
+  Timer timer;
+  timer.Start();
+  {
+    ThreadPool pool(num_threads, mode);
+    auto child = [&remaining, &done] {
+      BusyWork(FLAGS_work);
+      if (remaining.fetch_sub(1) == 1) { done.set_value(); }
+    };
+    auto parent = [&pool, &child] {
+      for (int i = 0; i < FLAGS_fanout; ++i) { pool.enqueue(child); }
+    };
+    for (int i = 0; i < FLAGS_num_tasks / FLAGS_fanout; ++i) {
+      pool.enqueue(parent);
+    }
+    done.get_future().wait();
+  }
+  report.Add("nested", {{"threads", num_threads}, {"mode", mode_name}},
+             FLAGS_num_tasks / FLAGS_fanout * FLAGS_fanout, timer.Seconds());
+}
+
+// 每轮提交kBatch个任务并等待完成. 先预热几轮, 让BlockPool和任务队列
+// 达到需要的容量, 之后统计每个任务平均分配了几次内存.
+static void CountAllocations(BenchmarkReport& report, int num_threads,
+                             ThreadPool::Mode mode,
+                             const std::string& mode_name, bool use_post) {
+  constexpr int kBatch = 1000;
+  constexpr int kWarmupRounds = 5;
+  constexpr int kRounds = 50;
+  ThreadPool pool(num_threads, mode);
+  std::vector<std::future<void>> results;
+  results.reserve(kBatch);
+  std::atomic<int> finished{0};
+  auto run_batch = [&] {
+    if (use_post) {
+      finished = 0;
+      for (int i = 0; i < kBatch; ++i) {
+        pool.post([&finished] {
+          BusyWork(FLAGS_work);
+          finished.fetch_add(1);
+        });  // NOFORMAT(-3:)
+      }
+      // 不能用promise等待, 它本身就要分配内存
+      while (finished.load() < kBatch) { std::this_thread::yield(); }
+    } else {
+      for (int i = 0; i < kBatch; ++i) {
+        results.push_back(pool.enqueue(BusyWork, FLAGS_work));
+      }
+      for (auto& result : results) { result.get(); }
+      results.clear();
+    }
+  };
+  for (int i = 0; i < kWarmupRounds; ++i) { run_batch(); }
+  auto before = g_allocations.load();
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < kRounds; ++i) { run_batch(); }
+  auto seconds = timer.Seconds();
+  auto allocations = double(g_allocations.load() - before) / (kRounds * kBatch);
+  const char* api = use_post ? "post" : "enqueue";
+  auto& result = report.Add(
+      "allocations",
+      {{"threads", num_threads}, {"mode", mode_name}, {"api", api}},
+      kRounds * kBatch, seconds);
+  result["allocations_per_task"] = allocations;
+}
+
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  google::LogToStderr();
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  using Mode = ThreadPool::Mode;
+  const std::vector<std::pair<Mode, std::string>> modes = {
+      {Mode::kShared, "shared"}, {Mode::kWorkStealing, "work-stealing"}};
+  BenchmarkReport report("thread_pool");
+  for (const auto& mode : modes) {
+    for (int num_threads : {1, 4, 16, 64}) {
+      RunExternal(report, num_threads, mode.first, mode.second);
+    }
+  }
+  for (const auto& mode : modes) {
+    for (int num_threads : {1, 4, 16, 64}) {
+      RunNested(report, num_threads, mode.first, mode.second);
+    }
+  }
+  for (const auto& mode : modes) {
+    for (bool use_post : {false, true}) {
+      CountAllocations(report, 4, mode.first, mode.second, use_post);
+    }
+  }
+  report.Save(FLAGS_output);
+  return 0;
+}
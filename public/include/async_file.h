@@ -0,0 +1,70 @@
+#ifndef PUBLIC_ASYNC_FILE_H_
+#define PUBLIC_ASYNC_FILE_H_
+
+#include "common.h"
+#include "thread_pool.h"
+
+// 异步读写整个文件的引擎, 适合大量小文件的场景.
+//
+// kIoUring: 所有请求的open/read/write/close都通过一个io_uring提交, 由一个
+// 后台线程收割完成事件并推进每个请求的下一步. 同一时刻在途的请求数不超过
+// queue_depth, 多出来的排队等待. 一批请求只需要一次io_uring_enter, 几个
+// 线程就能维持很深的IO队列. 直接使用系统调用, 不依赖liburing.
+// kThreadPool: 内核不支持io_uring(版本低于5.6, 或者被seccomp禁用)时的后备
+// 实现, 在num_threads个线程中执行普通的open/read/write/close.
+// kAuto: 优先使用io_uring, 不可用时退回到线程池.
+//
+// 回调在后台线程中执行, 应该尽快返回, 耗时的工作请转交给其他线程池.
+// 析构时等待所有请求完成.
+class AsyncFileIO {
+ public:
+  enum class Backend { kAuto, kIoUring, kThreadPool };
+  // ok为false时content为空
+  using ReadCallback = std::function<void(bool ok, std::string& content)>;
+  using WriteCallback = std::function<void(bool ok)>;
+
+  explicit AsyncFileIO(Backend backend = Backend::kAuto, int queue_depth = 128,
+                       int num_threads = 2);
+  DISABLE_COPY_ASIGN(AsyncFileIO);
+  DISABLE_MOVE_ASIGN(AsyncFileIO);
+  ~AsyncFileIO();
+
+  // 实际使用的后端, kIoUring或者kThreadPool
+  Backend backend() const { return backend_; }
+
+  // 读取文件的全部内容, 失败时返回空字符串, 与ReadFile一致
+  void AsyncReadFile(const std::string& file, ReadCallback callback);
+  std::future<std::string> AsyncReadFile(const std::string& file);
+
+  // 写入文件的全部内容, 必要的时候生成目录, 与WriteFile一致
+  void AsyncWriteFile(const std::string& file, std::string content,
+                      WriteCallback callback);
+  std::future<bool> AsyncWriteFile(const std::string& file,
+                                   std::string content);
+
+  // 批量接口: 一次提交所有文件, 等待全部完成. 结果与files的顺序一致,
+  // 读取失败的文件对应空字符串; 写入时只要有一个失败就返回false.
+  std::vector<std::string> ReadFiles(const std::vector<std::string>& files);
+  bool WriteFiles(const std::vector<std::string>& files,
+                  std::vector<std::string> contents);
+
+  // 等待已经提交的所有请求完成
+  void Wait();
+
+ private:
+  struct Request;
+  class Engine;
+  class UringEngine;
+  class PosixEngine;
+
+  void Submit(const std::vector<Request*>& requests);
+  void Complete(Request* request, bool ok);
+
+  Backend backend_;
+  std::unique_ptr<Engine> engine_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  int64_t outstanding_ = 0;
+};
+
+#endif  // PUBLIC_ASYNC_FILE_H_
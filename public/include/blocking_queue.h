@@ -14,7 +14,7 @@ template <class T> class BlockingQueue {
   // 容易产生race condition, 使用的时候需要特别注意.
   bool full() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return queue_.size() == capacity_;
+    return int(queue_.size()) == capacity_;
   }
   bool empty() const {
     std::lock_guard<std::mutex> lock(mutex_);
@@ -33,9 +33,7 @@ template <class T> class BlockingQueue {
   bool push(T value) {
     {
       std::unique_lock<std::mutex> lock(mutex_);
-      condition_push_.wait(lock, [this] {
-        return (queue_.size() < capacity_) || aborted_;
-      });  // NOFORMAT(-2:)
+      this->WaitForSpace(lock);
       if (aborted_) { return false; }
       queue_.push(std::move(value));
     }
@@ -45,9 +43,7 @@ template <class T> class BlockingQueue {
   bool pop(T& value) {
     {
       std::unique_lock<std::mutex> lock(mutex_);
-      condition_pop_.wait(lock, [this] {
-        return (!queue_.empty()) || aborted_;
-      });  // NOFORMAT(-2:)
+      this->WaitForItems(lock);
       if (aborted_ && queue_.empty()) { return false; }
       value = std::move(queue_.front());
       queue_.pop();
@@ -61,13 +57,104 @@ template <class T> class BlockingQueue {
     condition_push_.notify_all();
   }
 
+  // 下面是批量操作, 每一批只加一次锁, 并按实际存取的数量唤醒对端.
+  // 返回值均为实际存取的元素个数.
+
+  // 依次push [first, last)中的元素, 队列满的时候阻塞, 中途abort则提前返回
+  template <class Iterator> int push_many(Iterator first, Iterator last) {
+    int total = 0;
+    while (first != last) {
+      int count = 0;
+      int wake = 0;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        this->WaitForSpace(lock);
+        if (aborted_) { return total; }
+        for (; first != last && int(queue_.size()) < capacity_; ++first) {
+          queue_.push(std::move(*first));
+          ++count;
+        }
+        wake = std::min(count, pop_waiters_);
+      }
+      this->Notify(condition_pop_, wake);
+      total += count;
+    }
+    return total;
+  }
+  // 阻塞到队列非空, 然后取出最多max_items个元素追加到out末尾.
+  // max_items必须大于0. 返回0表示队列已经abort并且为空.
+  int pop_many(std::vector<T>& out, int max_items) {
+    CHECK_GT(max_items, 0) << "pop_many needs max_items > 0.";
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->WaitForItems(lock);
+    return this->PopLocked(lock, out, max_items);
+  }
+  // 不阻塞, 取出队列中当前所有的元素追加到out末尾
+  int drain(std::vector<T>& out) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return this->PopLocked(lock, out, std::numeric_limits<int>::max());
+  }
+  // 在timeout时间内尽量凑满max_items个元素, 超时或者abort时返回已经取到的
+  // 部分. 等待过程中取到的元素会立即从队列中移走, 以便生产者继续push.
+  template <class Rep, class Period>
+  int pop_many_for(std::vector<T>& out, int max_items,
+                   const std::chrono::duration<Rep, Period>& timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    int total = 0;
+    while (total < max_items) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ++pop_waiters_;
+      bool ready = condition_pop_.wait_until(lock, deadline, [this] {
+        return (!queue_.empty()) || aborted_;
+      });  // NOFORMAT(-2:)
+      --pop_waiters_;
+      total += this->PopLocked(lock, out, max_items - total);
+      if (!ready || aborted_) { break; }
+    }
+    return total;
+  }
+
  private:
+  // 等待的同时维护等待者的数量, 批量操作据此决定唤醒多少个线程
+  void WaitForSpace(std::unique_lock<std::mutex>& lock) {
+    ++push_waiters_;
+    condition_push_.wait(lock, [this] {
+      return (int(queue_.size()) < capacity_) || aborted_;
+    });  // NOFORMAT(-2:)
+    --push_waiters_;
+  }
+  void WaitForItems(std::unique_lock<std::mutex>& lock) {
+    ++pop_waiters_;
+    condition_pop_.wait(lock, [this] {
+      return (!queue_.empty()) || aborted_;
+    });  // NOFORMAT(-2:)
+    --pop_waiters_;
+  }
+  // 调用时必须持有锁, 返回前释放锁并唤醒相应数量的生产者
+  int PopLocked(std::unique_lock<std::mutex>& lock, std::vector<T>& out,
+                int max_items) {
+    int count = 0;
+    for (; count < max_items && !queue_.empty(); ++count) {
+      out.push_back(std::move(queue_.front()));
+      queue_.pop();
+    }
+    int wake = std::min(count, push_waiters_);
+    lock.unlock();
+    this->Notify(condition_push_, wake);
+    return count;
+  }
+  static void Notify(std::condition_variable& condition, int wake) {
+    for (int i = 0; i < wake; ++i) { condition.notify_one(); }
+  }
+
   int capacity_;
   std::queue<T> queue_;
   mutable std::mutex mutex_;
   std::condition_variable condition_pop_;
   std::condition_variable condition_push_;
   bool aborted_ = false;
+  int push_waiters_ = 0;
+  int pop_waiters_ = 0;
 };
 
 template <class T>  // NOFORMAT(:1)
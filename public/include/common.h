@@ -56,6 +56,8 @@
 #include <regex>
 #include <mutex>
 #include <queue>
+#include <deque>
+#include <atomic>
 #include <cctype>
 #include <chrono>
 #include <future>
@@ -63,9 +65,14 @@
 #include <string>
 #include <thread>
 #include <vector>
+#include <limits>
 #include <fstream>
 #include <iomanip>
+#include <numeric>
+#include <charconv>
 #include <streambuf>
+#include <string_view>
+#include <algorithm>
 #include <functional>
 #include <condition_variable>
 
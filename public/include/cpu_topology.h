@@ -0,0 +1,58 @@
+#ifndef PUBLIC_CPU_TOPOLOGY_H_
+#define PUBLIC_CPU_TOPOLOGY_H_
+
+#include "common.h"
+
+// 机器的cpu和NUMA拓扑, 读取/sys/devices/system/node, 不依赖libnuma.
+// Linux默认按first-touch分配内存: 页面分配在第一次写它的线程所在的节点上.
+// 所以线程绑定到某个节点之后, 只要数据也由这个节点上的线程分配和初始化,
+// 数据和计算就在同一个节点上, 不需要额外设置内存策略.
+
+struct NumaNode {
+  int id = 0;             // sysfs中的节点编号, 不一定连续
+  std::vector<int> cpus;  // 节点中当前进程可以使用的cpu, 升序
+};
+
+struct CpuTopology {
+  std::vector<int> cpus;        // 当前进程可以使用的所有cpu, 升序
+  std::vector<NumaNode> nodes;  // 至少有一个可用cpu的节点, 按id升序
+
+  // 第一次调用时读取并缓存. 没有NUMA信息时(非NUMA内核, 容器中sysfs不完整
+  // 等)所有cpu都属于节点0.
+  static const CpuTopology& Get();
+  // 从node_dir(形如/sys/devices/system/node)读取, 只保留allowed中的cpu
+  static CpuTopology Load(const std::string& node_dir,
+                          const std::vector<int>& allowed);
+
+  // cpu所在节点在nodes中的下标, 找不到时返回-1
+  int NodeIndexOf(int cpu) const;
+};
+
+// worker线程的cpu分配方式
+enum class CpuAffinity {
+  kNone,     // 不绑定, 由调度器决定
+  kCompact,  // 用完一个节点的cpu再用下一个, 相邻的worker共享缓存和内存
+  kScatter,  // 轮流从各个节点取cpu, worker均匀分布在各个节点上
+};
+
+// 按affinity排列topology中的cpu, 第i个worker绑定到结果中的第i个cpu.
+// kNone时返回空.
+std::vector<int> OrderCpus(const CpuTopology& topology, CpuAffinity affinity);
+
+// 解析和生成"0-3,8,10-11"格式的cpu列表, 即sysfs中cpulist的格式.
+// 解析结果升序并去重, 格式错误时返回false.
+bool ParseCpuList(std::string_view content, std::vector<int>& cpus);
+std::string FormatCpuList(const std::vector<int>& cpus);
+
+// 当前线程允许运行的cpu, 升序
+std::vector<int> GetThreadAffinity();
+// 把当前线程限制在cpus上运行. cpus为空, 或者其中没有当前cgroup允许的cpu
+// 时返回false, 线程的affinity不变.
+bool SetThreadAffinity(const std::vector<int>& cpus);
+// 当前线程正在运行的cpu, 失败时返回-1
+int GetCurrentCpu();
+// 设置当前线程的名字, 显示在top -H, gdb和/proc/<pid>/task/<tid>/comm中.
+// Linux限制为15个字符, 超出的部分被截掉.
+void SetThreadName(const std::string& name);
+
+#endif  // PUBLIC_CPU_TOPOLOGY_H_
@@ -0,0 +1,78 @@
+#ifndef PUBLIC_DIRECTORY_H_
+#define PUBLIC_DIRECTORY_H_
+
+#include "common.h"
+
+// 目录中的一项
+struct DirEntry {
+  enum class Type { kUnknown, kFile, kDirectory, kSymlink, kOther };
+
+  std::string name;
+  Type type = Type::kUnknown;
+  uint64_t inode = 0;
+};
+
+// 文件名过滤条件, 为空的条件不检查, 所有非空条件都满足才算匹配.
+// glob支持: * 任意多个字符, ? 任意一个字符, [abc] [a-z] [!a-z] 字符集合,
+// \ 转义. 与shell不同, *和?也可以匹配以.开头的文件名.
+struct NameFilter {
+  std::string prefix;
+  std::string suffix;
+  std::string glob;
+
+  bool Match(std::string_view name) const;
+};
+
+// 判断name是否匹配glob模式, 语法见NameFilter
+bool GlobMatch(std::string_view pattern, std::string_view name);
+
+// 通过getdents64列出目录中满足filter的项, 不包括.和.., 不排序.
+// 文件类型直接来自d_type, 文件系统不提供d_type时才调用fstatat.
+// 目录打开失败返回false.
+bool ListEntries(const std::string& dirname, std::vector<DirEntry>& entries,
+                 const NameFilter& filter = NameFilter());
+
+// 通过inotify维护一个目录中满足filter的文件列表. 构造时完整扫描一次,
+// 之后每次Update只处理这段时间内的inotify事件, 开销与变化的数量成正比,
+// 与目录中的文件总数无关. 事件队列溢出时自动重新扫描.
+// 只监视目录本身, 不包括子目录. 不是线程安全的.
+//   DirectoryIndex index(spool_dir, NameFilter{"", ".json", ""});
+//   while (true) {
+//     std::vector<std::string> added;
+//     index.Update(&added);
+//     ...
+//   }
+class DirectoryIndex {
+ public:
+  explicit DirectoryIndex(const std::string& dirname,
+                          const NameFilter& filter = NameFilter());
+  DISABLE_COPY_ASIGN(DirectoryIndex);
+  DISABLE_MOVE_ASIGN(DirectoryIndex);
+  ~DirectoryIndex();
+
+  // 目录存在, 并且inotify可用
+  bool is_valid() const { return inotify_fd_ >= 0; }
+
+  // 处理积压的事件, 可选地返回新增和删除的文件名. 重命名视为删除旧名字,
+  // 新增新名字. 目录被删除或者移走之后返回false, 列表被清空.
+  bool Update(std::vector<std::string>* added = nullptr,
+              std::vector<std::string>* removed = nullptr);
+
+  // 当前的列表, 按文件名排序, 不会自动Update
+  const std::map<std::string, DirEntry>& entries() const { return entries_; }
+  // Update之后返回排序的文件名, 结果与ListDirectory相同
+  std::vector<std::string> List();
+
+ private:
+  void Rescan(std::vector<std::string>* added,
+              std::vector<std::string>* removed);
+  void Close();
+
+  std::string dirname_;
+  NameFilter filter_;
+  int inotify_fd_ = -1;
+  std::map<std::string, DirEntry> entries_;
+  std::vector<char> buffer_;
+};
+
+#endif  // PUBLIC_DIRECTORY_H_
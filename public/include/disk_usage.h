@@ -0,0 +1,59 @@
+#ifndef PUBLIC_DISK_USAGE_H_
+#define PUBLIC_DISK_USAGE_H_
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "common.h"
+#include "thread_pool.h"
+
+// 统计文件或者目录占用的字节数, 结果与GetFileSize一致: 普通文件计文件大小,
+// 每个目录计4096字节, 链接等其他类型的文件不计.
+//
+// 通过readdir返回的d_type区分文件类型, 每个普通文件只需要一次fstatat.
+// 提供pool时, 子目录会分发到pool中并行扫描, 调用线程也参与扫描.
+//
+// 开启缓存时, 以目录的inode和mtime为键记录该目录下直接包含的文件总大小和
+// 子目录列表. 再次统计时, mtime没有变化的目录只需要一次stat, 不再遍历.
+// 每次统计之后, path下本次没有扫描到的目录(已经被删除)会从缓存中清除.
+// 注意: 目录的mtime只在其中增删或者重命名文件时改变, 原地修改已有文件的
+// 内容不会改变目录的mtime, 这种变化要等ClearCache之后才能统计到.
+class DiskUsage {
+ public:
+  explicit DiskUsage(ThreadPool* pool = nullptr, bool enable_cache = false)
+      : pool_(pool), enable_cache_(enable_cache) {}
+  DISABLE_COPY_ASIGN(DiskUsage);
+  DISABLE_MOVE_ASIGN(DiskUsage);
+  ~DiskUsage() = default;
+
+  // 无效路径返回-1
+  int64_t GetSize(const std::string& path);
+  void ClearCache();
+  // 缓存中的目录数
+  int num_cached();
+
+ private:
+  struct CacheEntry {
+    uint64_t inode = 0;
+    int64_t mtime = 0;  // 纳秒
+    int64_t file_bytes = 0;
+    std::vector<std::string> subdirs;
+  };
+  struct ScanState;
+
+  // 扫描一个目录, 返回该目录自身和直接包含的文件的大小, 子目录追加到subdirs
+  int64_t ScanDirectory(const std::string& path,
+                        std::vector<std::string>& subdirs);
+  // is_caller为false时是pool中的辅助任务, 没有待扫描的目录时立即返回
+  static void RunScan(const std::shared_ptr<ScanState>& state, bool is_caller);
+  // 删除缓存中root下不在visited中的目录
+  void PruneCache(const std::string& root,
+                  const std::unordered_set<std::string>& visited);
+
+  ThreadPool* pool_;
+  bool enable_cache_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, CacheEntry> cache_;
+};
+
+#endif  // PUBLIC_DISK_USAGE_H_
@@ -0,0 +1,96 @@
+#ifndef PUBLIC_FILE_WRITER_H_
+#define PUBLIC_FILE_WRITER_H_
+
+#include <unordered_set>
+
+#include "common.h"
+#include "thread_pool.h"
+
+// 后台写文件的服务, 用来代替频繁调用的WriteFile/WriteJsonFile:
+//   FileWriter writer;
+//   writer.Write("a/b.txt", content);          // 立即返回
+//   writer.WriteJson(root, "a/c.json").get();  // 等待落盘
+//
+// 提交的文件由一个后台线程成组提交(group commit): 上一组在写盘或者fsync的
+// 时候到达的文件组成下一组, 一组中的文件在线程池中并行写入和fdatasync,
+// 然后按提交顺序依次rename, 最后每个涉及的目录只fsync一次. 并发的fsync会被
+// 文件系统合并成少数几次日志提交, 所以写很多小文件时不必为每个文件付出一次
+// 完整的fsync. 同一个文件在一组中被写多次时, 最后提交的内容生效.
+//
+// 已经创建过的目录记录在缓存中, 不再重复检查. 目录在外部被删除时,
+// 打开文件失败后会重新创建.
+class FileWriter {
+ public:
+  enum class Durability {
+    // 直接写目标文件, 不fsync, 与WriteFile相同. 崩溃可能留下写了一半的文件.
+    kNone,
+    // 先写同目录下的临时文件再rename, 进程崩溃时目标文件要么是旧内容要么
+    // 是新内容. 不fsync, 掉电时仍可能丢失或者截断.
+    kAtomic,
+    // 在kAtomic的基础上, rename之前fdatasync临时文件, rename之后fsync目录,
+    // 回调或者future返回true时文件已经落盘.
+    kDurable,
+  };
+  using Callback = std::function<void(bool ok)>;
+
+  explicit FileWriter(Durability durability = Durability::kDurable,
+                      int num_threads = 4, int max_batch = 256);
+  DISABLE_COPY_ASIGN(FileWriter);
+  DISABLE_MOVE_ASIGN(FileWriter);
+  // 等待所有已经提交的文件写完
+  ~FileWriter();
+
+  Durability durability() const { return durability_; }
+
+  // 回调在后台线程中执行, 应该尽快返回
+  void Write(const std::string& file, std::string content, Callback callback);
+  std::future<bool> Write(const std::string& file, std::string content);
+  // 在调用线程中序列化, 格式与WriteJsonFile相同
+  std::future<bool> WriteJson(const Json::Value& root,
+                              const std::string& json_file);
+
+  // 等待已经提交的所有文件写完
+  void Flush();
+
+  // 已经完成的组数和文件数, 用于观察成组的效果
+  int64_t num_batches() const { return num_batches_.load(); }
+  int64_t num_files() const { return num_files_.load(); }
+
+ private:
+  struct Item {
+    std::string file;
+    std::string content;
+    Callback callback;
+    std::string temp;  // 临时文件, kNone时为空
+    bool ok = true;
+  };
+
+  void Run();
+  void Commit(std::vector<Item>& batch);
+  // 写入一个文件, kDurable时同时fdatasync
+  bool WriteItem(Item& item);
+  // 确保目录存在, 新创建的目录的上一级目录加入new_parents
+  bool MakeDirs(const std::string& dirname,
+                std::vector<std::string>* new_parents);
+
+  const Durability durability_;
+  const size_t max_batch_;
+  ThreadPool pool_;
+
+  std::mutex mutex_;  // 保护以下成员
+  std::condition_variable condition_;
+  std::condition_variable flushed_;
+  std::deque<Item> pending_;
+  int64_t submitted_ = 0;
+  int64_t completed_ = 0;
+  bool stop_ = false;
+
+  std::mutex dirs_mutex_;
+  std::unordered_set<std::string> dirs_;
+  std::atomic<uint64_t> sequence_{0};
+  std::atomic<int64_t> num_batches_{0};
+  std::atomic<int64_t> num_files_{0};
+  std::thread thread_;
+};
+
+#endif  // PUBLIC_FILE_WRITER_H_
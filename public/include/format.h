@@ -0,0 +1,134 @@
+#ifndef PUBLIC_FORMAT_H_
+#define PUBLIC_FORMAT_H_
+
+#include "common.h"
+
+// 把value格式化后追加到buffer末尾, 基于std::to_chars, 不经过boost::format
+// 和ostringstream, 也不构造中间字符串. buffer可以反复使用, 容量足够之后
+// 不再分配内存:
+//   std::string buffer;
+//   for (const auto& request : requests) {
+//     buffer.clear();
+//     AppendString(buffer, request.ids);
+//     LOG(INFO) << buffer;
+//   }
+// 格式:
+//   整数(包括char, bool, 枚举)  %d
+//   浮点数                      %.2f
+//   字符串                      原样输出
+//   pair/tuple                  (a, b)
+//   map/unordered_map           {k: v, k: v}
+//   其他容器                    [a, b]
+// 容器和pair可以任意嵌套. 其他类型可以提供非模板的重载
+// void AppendString(std::string&, const MyType&), 嵌套时通过ADL找到.
+template <class T> void AppendString(std::string& buffer, const T& value);
+
+// 按%.{precision}f格式追加浮点数
+template <class T>
+void AppendFixed(std::string& buffer, T value, int precision = 2);
+
+//////////////////////////////// implementation ////////////////////////////////
+
+namespace format_internal {
+
+template <class T, class = void> struct IsRange : std::false_type {};
+template <class T>
+struct IsRange<T, std::void_t<decltype(std::begin(std::declval<const T&>())),
+                              decltype(std::end(std::declval<const T&>()))>>
+    : std::true_type {};
+
+template <class T, class = void> struct IsMap : std::false_type {};
+template <class T>
+struct IsMap<T, std::void_t<typename T::key_type, typename T::mapped_type>>
+    : std::true_type {};
+
+template <class T, class = void> struct IsTuple : std::false_type {};
+template <class T>
+struct IsTuple<T, std::void_t<decltype(std::tuple_size<T>::value)>>
+    : std::true_type {};
+
+template <class T>
+constexpr bool kIsString =
+    std::is_convertible<const T&, std::string_view>::value;
+
+template <class T> struct AlwaysFalse : std::false_type {};
+
+template <class T> void AppendInteger(std::string& buffer, T value) {
+  // +value把char和bool提升为int, 按数字输出
+  char digits[24];
+  auto result = std::to_chars(digits, digits + sizeof(digits), +value);
+  buffer.append(digits, result.ptr);
+}
+
+template <class T, size_t... I>
+void AppendTuple(std::string& buffer, const T& value,
+                 std::index_sequence<I...>) {
+  auto append = [&buffer](size_t index, const auto& element) {
+    if (index > 0) { buffer.append(", "); }
+    AppendString(buffer, element);
+  };
+  buffer.push_back('(');
+  (append(I, std::get<I>(value)), ...);
+  buffer.push_back(')');
+}
+
+}  // namespace format_internal
+
+template <class T> void AppendFixed(std::string& buffer, T value,
+                                    int precision) {
+  char digits[128];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value,
+                              std::chars_format::fixed, precision);
+  if (result.ec == std::errc()) {
+    buffer.append(digits, result.ptr);
+    return;
+  }
+  // 整数部分超过100位的极大值, 直接在buffer中预留足够的空间
+  size_t size = buffer.size();
+  buffer.resize(size + std::numeric_limits<T>::max_exponent10 + precision + 8);
+  result = std::to_chars(&buffer[size], &buffer[0] + buffer.size(), value,
+                         std::chars_format::fixed, precision);
+  buffer.resize(size_t(result.ptr - buffer.data()));
+}
+
+template <class T> void AppendString(std::string& buffer, const T& value) {
+  namespace internal = format_internal;
+  if constexpr (std::is_integral<T>::value) {
+    internal::AppendInteger(buffer, value);
+  } else if constexpr (std::is_enum<T>::value) {
+    internal::AppendInteger(buffer,
+                            static_cast<std::underlying_type_t<T>>(value));
+  } else if constexpr (std::is_floating_point<T>::value) {
+    AppendFixed(buffer, value);
+  } else if constexpr (internal::kIsString<T>) {
+    buffer.append(std::string_view(value));
+  } else if constexpr (internal::IsMap<T>::value) {
+    buffer.push_back('{');
+    bool first = true;
+    for (const auto& pair : value) {
+      if (!first) { buffer.append(", "); }
+      first = false;
+      AppendString(buffer, pair.first);
+      buffer.append(": ");
+      AppendString(buffer, pair.second);
+    }
+    buffer.push_back('}');
+  } else if constexpr (internal::IsRange<T>::value) {
+    buffer.push_back('[');
+    bool first = true;
+    for (const auto& element : value) {
+      if (!first) { buffer.append(", "); }
+      first = false;
+      AppendString(buffer, element);
+    }
+    buffer.push_back(']');
+  } else if constexpr (internal::IsTuple<T>::value) {
+    constexpr size_t size = std::tuple_size<T>::value;
+    internal::AppendTuple(buffer, value, std::make_index_sequence<size>());
+  } else {
+    static_assert(internal::AlwaysFalse<T>::value,
+                  "AppendString: unsupported type, provide an overload");
+  }
+}
+
+#endif  // PUBLIC_FORMAT_H_
@@ -0,0 +1,117 @@
+#ifndef PUBLIC_INLINE_TASK_H_
+#define PUBLIC_INLINE_TASK_H_
+
+#include "common.h"
+#include "pool_allocator.h"
+
+// 只能移动的void()可调用对象, 用来代替std::function<void()>.
+// 不超过kInlineSize字节的可调用对象直接存放在对象内部, 不分配内存;
+// 更大的从BlockPool中分配, 超过BlockPool::kMaxSize时才使用operator new.
+// 与std::function不同, 可以保存只能移动的对象, 比如std::promise.
+class InlineTask {
+ public:
+  static constexpr size_t kInlineSize = 48;
+
+  InlineTask() = default;
+  InlineTask(std::nullptr_t) {}  // NOLINT
+  template <class F, class = typename std::enable_if<
+                         !std::is_same<typename std::decay<F>::type,
+                                       InlineTask>::value>::type>
+  InlineTask(F&& f);  // NOLINT
+  DISABLE_COPY_ASIGN(InlineTask);
+  InlineTask(InlineTask&& other) noexcept { this->MoveFrom(other); }
+  InlineTask& operator=(InlineTask&& other) noexcept {
+    if (this != &other) {
+      this->Reset();
+      this->MoveFrom(other);
+    }
+    return *this;
+  }
+  InlineTask& operator=(std::nullptr_t) {
+    this->Reset();
+    return *this;
+  }
+  ~InlineTask() { this->Reset(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+  void operator()() { ops_->invoke(&storage_); }
+
+ private:
+  using Storage = typename std::aligned_storage<kInlineSize>::type;
+  struct Ops {
+    void (*invoke)(Storage* storage);
+    // 把src中的对象移动到dst中, 并析构src中的对象
+    void (*relocate)(Storage* dst, Storage* src);
+    void (*destroy)(Storage* storage);
+  };
+
+  template <class Fn>
+  static constexpr bool kFitsInline =
+      sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(Storage) &&
+      std::is_nothrow_move_constructible<Fn>::value;
+
+  // 放在storage_内部的对象
+  template <class Fn> struct InlineOps {
+    static Fn* Get(Storage* storage) { return reinterpret_cast<Fn*>(storage); }
+    static void Invoke(Storage* storage) { (*Get(storage))(); }
+    static void Relocate(Storage* dst, Storage* src) {
+      new (dst) Fn(std::move(*Get(src)));
+      Get(src)->~Fn();
+    }
+    static void Destroy(Storage* storage) { Get(storage)->~Fn(); }
+    static constexpr Ops kOps = {Invoke, Relocate, Destroy};
+  };
+  // storage_中只存放指针, 对象本身在BlockPool中
+  template <class Fn> struct PooledOps {
+    static Fn*& Get(Storage* storage) {
+      return *reinterpret_cast<Fn**>(storage);
+    }
+    static void Invoke(Storage* storage) { (*Get(storage))(); }
+    static void Relocate(Storage* dst, Storage* src) {
+      new (dst) Fn*(Get(src));
+    }
+    static void Destroy(Storage* storage) {
+      Get(storage)->~Fn();
+      BlockPool::Deallocate(Get(storage), sizeof(Fn));
+    }
+    static constexpr Ops kOps = {Invoke, Relocate, Destroy};
+  };
+
+  void MoveFrom(InlineTask& other) {
+    if (other.ops_ == nullptr) { return; }
+    other.ops_->relocate(&storage_, &other.storage_);
+    ops_ = other.ops_;
+    other.ops_ = nullptr;
+  }
+  void Reset() {
+    if (ops_ == nullptr) { return; }
+    ops_->destroy(&storage_);
+    ops_ = nullptr;
+  }
+
+  Storage storage_;
+  const Ops* ops_ = nullptr;
+};
+
+//////////////////////////////// implementation ////////////////////////////////
+
+template <class F, class>
+InlineTask::InlineTask(F&& f) {
+  using Fn = typename std::decay<F>::type;
+  if constexpr (kFitsInline<Fn>) {
+    new (&storage_) Fn(std::forward<F>(f));
+    ops_ = &InlineOps<Fn>::kOps;
+  } else {
+    static_assert(alignof(Fn) <= BlockPool::kAlignment, "over-aligned");
+    void* block = BlockPool::Allocate(sizeof(Fn));
+    try {
+      new (&storage_) Fn*(new (block) Fn(std::forward<F>(f)));
+    } catch (...) {
+      BlockPool::Deallocate(block, sizeof(Fn));
+      throw;
+    }
+    ops_ = &PooledOps<Fn>::kOps;
+  }
+}
+
+#endif  // PUBLIC_INLINE_TASK_H_
@@ -0,0 +1,141 @@
+#ifndef PUBLIC_JSON_LINES_H_
+#define PUBLIC_JSON_LINES_H_
+
+#include "common.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+// 每行一个json的文件(JSON Lines)的流式读写, 内存占用与文件大小无关.
+//
+//   JsonLinesReader reader("log.jsonl");
+//   Json::Value record;
+//   while (reader.Next(record)) { ... }
+//
+//   JsonLinesWriter writer("out.jsonl");
+//   writer.Write(record);
+//
+// 解析和序列化使用当前线程复用的CharReader和StreamWriter, 不会每条记录都
+// 构造一次. 空行被跳过; 无法解析的行记录到日志后跳过, 并计入num_errors.
+
+// 当前线程复用的CharReader, 以及输出单行json的StreamWriter
+Json::CharReader& ThreadLocalJsonReader();
+Json::StreamWriter& ThreadLocalJsonWriter();
+
+class JsonLinesReader {
+ public:
+  // use_mmap为true时通过mmap读取普通文件, 否则(或者mmap失败时)每次read
+  // buffer_size个字节. 单行超过buffer_size时缓冲区会自动扩大.
+  explicit JsonLinesReader(const std::string& file, bool use_mmap = true,
+                           size_t buffer_size = 1 << 20);
+  DISABLE_COPY_ASIGN(JsonLinesReader);
+  DISABLE_MOVE_ASIGN(JsonLinesReader);
+  ~JsonLinesReader();
+
+  bool is_open() const { return mapped_.is_open() || fd_ >= 0; }
+  // 读取下一条记录, 没有更多记录时返回false
+  bool Next(Json::Value& record);
+  // 最近一条记录所在的行号, 从1开始
+  int64_t line_number() const { return line_number_; }
+  int64_t num_errors() const { return num_errors_; }
+
+  // 并行版本: 在换行处把文件切成大约batch_bytes大小的块, 放到pool中解析,
+  // 按文件中的顺序对每一块调用callback(std::vector<Json::Value>&).
+  // 同时在解析的块数不超过pool大小的两倍. 文件打开失败时返回false.
+  // 不要在pool的worker中调用, 否则可能因为等待自己所在的pool而死锁.
+  template <class F>
+  static bool ReadInBatches(const std::string& file, ThreadPool& pool,
+                            F callback, size_t batch_bytes = 4 << 20);
+  // 并行读取所有记录
+  static std::vector<Json::Value> ReadAll(const std::string& file,
+                                          ThreadPool& pool);
+
+  // 解析chunk中的每一行并追加到records, 返回无法解析的行数
+  static int64_t ParseChunk(std::string_view chunk,
+                            std::vector<Json::Value>& records);
+
+ private:
+  // 取出下一行, 不包含换行符, 没有更多内容时返回false
+  bool NextLine(std::string_view& line);
+  // 从文件中读取更多内容到buffer_, 文件结束返回false
+  bool Fill();
+
+  MappedFile mapped_;
+  std::string_view remaining_;  // mmap时尚未处理的内容
+  int fd_ = -1;
+  std::string buffer_;
+  size_t begin_ = 0;  // buffer_中[begin_, end_)是尚未处理的内容
+  size_t end_ = 0;
+  bool eof_ = false;
+  int64_t line_number_ = 0;
+  int64_t num_errors_ = 0;
+};
+
+class JsonLinesWriter {
+ public:
+  // 缓冲区超过buffer_size时写入文件, 必要的时候生成目录
+  explicit JsonLinesWriter(const std::string& file, bool append = false,
+                           size_t buffer_size = 1 << 20);
+  DISABLE_COPY_ASIGN(JsonLinesWriter);
+  DISABLE_MOVE_ASIGN(JsonLinesWriter);
+  // 析构时写入缓冲区中剩余的内容
+  ~JsonLinesWriter();
+
+  bool is_open() const { return fd_ >= 0; }
+  // 追加一条记录, 写文件失败时返回false
+  bool Write(const Json::Value& record);
+  // 把缓冲区中的内容写入文件
+  bool Flush();
+
+ private:
+  class AppendBuf;
+
+  int fd_ = -1;
+  size_t buffer_size_;
+  std::string buffer_;
+  std::unique_ptr<AppendBuf> streambuf_;
+  std::unique_ptr<std::ostream> stream_;
+};
+
+//////////////////////////////// implementation ////////////////////////////////
+
+template <class F>
+bool JsonLinesReader::ReadInBatches(const std::string& file, ThreadPool& pool,
+                                    F callback, size_t batch_bytes) {
+  MappedFile mapped(file, MappedFile::Advice::kSequential);
+  if (!mapped.is_open()) { return false; }
+  batch_bytes = std::max<size_t>(batch_bytes, 1);
+
+  std::deque<std::future<std::vector<Json::Value>>> pending;
+  auto content = mapped.view();
+  auto submit = [&content, &pending, &pool, batch_bytes] {
+    if (content.empty()) { return false; }
+    auto length = content.find('\n', std::min(batch_bytes, content.size()) - 1);
+    length = std::min(length, content.size() - 1) + 1;
+    auto chunk = content.substr(0, length);
+    content.remove_prefix(length);
+    pending.push_back(pool.enqueue([chunk] {
+      std::vector<Json::Value> records;
+      ParseChunk(chunk, records);
+      return records;
+    }));
+    return true;
+  };
+
+  const size_t max_pending = std::max(2, pool.size() * 2);
+  try {
+    while (pending.size() < max_pending && submit()) {}
+    while (!pending.empty()) {
+      auto records = pending.front().get();
+      pending.pop_front();
+      submit();
+      if (!records.empty()) { callback(records); }
+    }
+  } catch (...) {
+    // 解析任务引用着映射的内存, 必须等它们结束
+    for (auto& result : pending) { result.wait(); }
+    throw;
+  }
+  return true;
+}
+
+#endif  // PUBLIC_JSON_LINES_H_
@@ -0,0 +1,58 @@
+#ifndef PUBLIC_MAPPED_FILE_H_
+#define PUBLIC_MAPPED_FILE_H_
+
+#include "common.h"
+
+// 只读的内存映射文件, 析构时自动解除映射.
+// 文件内容直接来自page cache, 不做拷贝, 多个进程映射同一个文件时共享内存.
+// 映射期间文件被截断的话, 访问越界部分会触发SIGBUS, 使用时需要注意.
+class MappedFile {
+ public:
+  // 对应madvise的几种访问模式提示
+  enum class Advice { kNormal, kSequential, kRandom, kWillNeed, kDontNeed };
+
+  MappedFile() = default;
+  explicit MappedFile(const std::string& file,
+                      Advice advice = Advice::kSequential);
+  DISABLE_COPY_ASIGN(MappedFile);
+  MappedFile(MappedFile&& other) noexcept { this->Swap(other); }
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+      this->Close();
+      this->Swap(other);
+    }
+    return *this;
+  }
+  ~MappedFile() { this->Close(); }
+
+  // 打开并映射文件, 失败返回false. 空文件也视为成功, 此时data()为nullptr.
+  bool Open(const std::string& file, Advice advice = Advice::kSequential);
+  void Close();
+
+  // 对[offset, offset + length)这一段给出访问模式提示, length为0表示到文件尾
+  void Advise(Advice advice, size_t offset = 0, size_t length = 0) const;
+
+  bool is_open() const { return is_open_; }
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  const char* data() const { return data_; }
+  const char* begin() const { return data_; }
+  const char* end() const { return data_ + size_; }
+  std::string_view view() const { return std::string_view(data_, size_); }
+  std::string_view view(size_t offset, size_t length) const {
+    return this->view().substr(offset, length);
+  }
+
+ private:
+  void Swap(MappedFile& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(is_open_, other.is_open_);
+  }
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool is_open_ = false;
+};
+
+#endif  // PUBLIC_MAPPED_FILE_H_
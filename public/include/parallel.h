@@ -0,0 +1,150 @@
+#ifndef PUBLIC_PARALLEL_H_
+#define PUBLIC_PARALLEL_H_
+
+#include "common.h"
+#include "thread_pool.h"
+
+// 基于ThreadPool的数据并行工具, 区间均为左闭右开: [begin, end).
+//
+// 区间被动态地切成若干块, 每个参与者(调用线程和至多pool.size()个辅助任务)
+// 反复领取剩余部分的一块来处理, 块的大小随剩余量递减, 但不小于grain.
+// grain <= 0时自动选择. 每个辅助任务处理很多块, 所以提交任务的开销只与
+// 线程数有关, 与元素个数无关. 调用线程本身也参与计算, 全部完成后才返回,
+// 因此在pool的worker内部调用也不会死锁. f抛出的第一个异常会在调用线程中
+// 重新抛出.
+
+// 对[begin, end)中的每个i调用f(i)
+template <class F>
+void ParallelFor(ThreadPool& pool, int64_t begin, int64_t end, F f,
+                 int64_t grain = 0);
+
+// 对[begin, end)中的每个i计算f(i), 再用reduce两两合并, 初值为identity.
+// 合并的顺序不确定, 所以reduce必须满足结合律和交换律.
+template <class T, class F, class R>
+T ParallelReduce(ThreadPool& pool, int64_t begin, int64_t end, T identity,
+                 F f, R reduce, int64_t grain = 0);
+
+// 与std::transform相同, 要求迭代器支持随机访问, 返回输出区间的末尾
+template <class InputIt, class OutputIt, class F>
+OutputIt ParallelTransform(ThreadPool& pool, InputIt first, InputIt last,
+                           OutputIt d_first, F f, int64_t grain = 0);
+
+//////////////////////////////// implementation ////////////////////////////////
+
+namespace parallel_internal {
+
+// 一次并行调用的共享状态. 辅助任务可能在调用返回之后才开始运行,
+// 所以状态由shared_ptr持有; 这种任务领不到块, 不会访问调用者的数据.
+struct ChunkState {
+  std::atomic<int64_t> next{0};
+  int64_t end = 0;
+  int64_t grain = 1;
+  int64_t divisor = 1;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  int64_t remaining = 0;
+  std::exception_ptr error;
+
+  // 领取下一块, 没有剩余时返回false
+  bool Claim(int64_t& chunk_begin, int64_t& chunk_end) {
+    int64_t start = next.load(std::memory_order_relaxed);
+    while (true) {
+      if (start >= end) { return false; }
+      int64_t size = std::max(grain, (end - start) / divisor);
+      int64_t stop = std::min(end, start + size);
+      if (next.compare_exchange_weak(start, stop)) {
+        chunk_begin = start;
+        chunk_end = stop;
+        return true;
+      }
+    }
+  }
+  void Finish(int64_t count, std::exception_ptr e) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (e && !error) { error = e; }
+    remaining -= count;
+    if (remaining == 0) { condition.notify_all(); }
+  }
+};
+
+// 并行地对每一块调用body(chunk_begin, chunk_end)
+template <class Body>
+void RunChunks(ThreadPool& pool, int64_t begin, int64_t end, int64_t grain,
+               const Body& body) {
+  if (begin >= end) { return; }
+  const int64_t total = end - begin;
+  const int64_t num_threads = std::max(1, pool.size());
+  if (grain <= 0) { grain = std::max<int64_t>(1, total / (num_threads * 16)); }
+
+  auto state = std::make_shared<ChunkState>();
+  state->next = begin;
+  state->end = end;
+  state->grain = grain;
+  state->divisor = (num_threads + 1) * 2;
+  state->remaining = total;
+
+  auto work = [state, &body] {
+    int64_t chunk_begin = 0;
+    int64_t chunk_end = 0;
+    while (state->Claim(chunk_begin, chunk_end)) {
+      std::exception_ptr error;
+      try {
+        body(chunk_begin, chunk_end);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      state->Finish(chunk_end - chunk_begin, error);
+    }
+  };
+
+  auto helpers = std::min(num_threads, (total + grain - 1) / grain - 1);
+  for (int64_t i = 0; i < helpers; ++i) { pool.post(work); }
+  work();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->condition.wait(lock, [&state] { return state->remaining == 0; });
+  if (state->error) { std::rethrow_exception(state->error); }
+}
+
+}  // namespace parallel_internal
+
+template <class F>
+void ParallelFor(ThreadPool& pool, int64_t begin, int64_t end, F f,
+                 int64_t grain) {
+  auto body = [&f](int64_t chunk_begin, int64_t chunk_end) {
+    for (int64_t i = chunk_begin; i < chunk_end; ++i) { f(i); }
+  };
+  parallel_internal::RunChunks(pool, begin, end, grain, body);
+}
+
+template <class T, class F, class R>
+T ParallelReduce(ThreadPool& pool, int64_t begin, int64_t end, T identity,
+                 F f, R reduce, int64_t grain) {
+  std::mutex mutex;
+  T result = identity;
+  auto body = [&](int64_t chunk_begin, int64_t chunk_end) {
+    T partial = identity;
+    for (int64_t i = chunk_begin; i < chunk_end; ++i) {
+      partial = reduce(std::move(partial), f(i));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    result = reduce(std::move(result), std::move(partial));
+  };
+  parallel_internal::RunChunks(pool, begin, end, grain, body);
+  return result;
+}
+
+template <class InputIt, class OutputIt, class F>
+OutputIt ParallelTransform(ThreadPool& pool, InputIt first, InputIt last,
+                           OutputIt d_first, F f, int64_t grain) {
+  auto body = [&](int64_t chunk_begin, int64_t chunk_end) {
+    std::transform(first + chunk_begin, first + chunk_end,
+                   d_first + chunk_begin, f);
+  };
+  int64_t count = std::distance(first, last);
+  parallel_internal::RunChunks(pool, 0, count, grain, body);
+  return d_first + count;
+}
+
+#endif  // PUBLIC_PARALLEL_H_
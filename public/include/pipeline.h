@@ -0,0 +1,538 @@
+#ifndef PUBLIC_PIPELINE_H_
+#define PUBLIC_PIPELINE_H_
+
+#include <optional>
+
+#include "blocking_queue.h"
+#include "common.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+// 多级流水线: 每一级(stage)由若干个worker并行处理, 相邻两级之间是有界的
+// BlockingQueue, 下游处理不过来时上游自然阻塞(背压).
+//
+//   Pipeline<std::string> pipeline;
+//   pipeline
+//       .Then([](std::string&& line) { return ParseRecord(line); },
+//             {"parse", 4})
+//       .ThenBatch(WriteRecords, {"write", 1, 1024, true, 256})
+//       .Sink([&](int64_t&& count) { total += count; }, {"count"});
+//   pipeline.Start();
+//   for (auto& line : lines) { pipeline.Push(std::move(line)); }
+//   pipeline.Close();  // 不再有输入, 处理完队列中剩余的数据后结束
+//   pipeline.Wait();   // 重新抛出stage中的第一个异常
+//
+// stage的形式:
+//   Then(f):       Out f(In&&), 返回std::optional<Out>时nullopt表示丢弃
+//   ThenBatch(f):  std::vector<Out> f(std::vector<In>&&), 输出个数任意
+//   Sink(f):       void f(In&&), 流水线的终点
+//   SinkBatch(f):  void f(std::vector<In>&&)
+// 每一级只能接一个下游, 最后必须以Sink或SinkBatch结束. parallelism大于1时
+// f会在多个线程中同时被调用.
+//
+// ordered的stage按输入的顺序输出; 所有stage都是ordered时, Sink收到的顺序
+// 与Push的顺序相同. Sink和SinkBatch设置ordered时parallelism必须为1.
+// 任何一个stage抛出异常或者调用Cancel时, 所有队列被abort, 队列中的数据
+// 被丢弃, 阻塞的Push返回false.
+
+struct PipelineStageOptions {
+  std::string name;        // 用于GetMetrics, 为空时为"stage<序号>"
+  int parallelism = 1;     // worker的个数
+  int queue_capacity = 1024;  // 这一级的输入队列的容量
+  // 是否按输入的顺序输出. 乱序完成的输出先暂存, 暂存的输入最多
+  // queue_capacity个, 超过时worker等待最前面的一批完成. sink没有输出,
+  // ordered时parallelism必须为1.
+  bool ordered = false;
+  int batch_size = 1;      // 每次最多取出这么多个输入一起处理
+  // 队列中不够batch_size时最多等待这么久来凑批, 0表示有多少取多少
+  std::chrono::milliseconds batch_timeout{0};
+};
+
+template <class T> class PipelineStream;
+
+namespace pipeline_internal {
+
+template <class T> struct Item {
+  int64_t seq = 0;
+  T value;
+};
+
+// 表示sink没有输出
+struct Empty {};
+
+template <class T> struct IsOptional : std::false_type {};
+template <class T> struct IsOptional<std::optional<T>> : std::true_type {};
+
+// 一级的输出端: 给数据编号并放入下游的队列. 编号和放入都在锁内完成,
+// 所以队列中的数据总是按编号递增, worker一次取出的一批编号是连续的.
+template <class T> class Emitter {
+ public:
+  using Queue = BlockingQueue<Item<T>>;
+
+  void Open(int capacity) { queue_.reset(new Queue(std::max(capacity, 1))); }
+  bool is_open() const { return queue_ != nullptr; }
+  Queue* queue() const { return queue_.get(); }
+  // 不再有新的数据, 下游取完剩余的数据之后退出
+  void Close() {
+    if (queue_) { queue_->abort(); }
+    // 先abort再加锁: 持有锁的Emit可能正阻塞在已满的队列上
+    ATOMIC_SET(mutex_, closed_, true);
+    window_.notify_all();
+  }
+
+  bool Push(T value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    items_.clear();
+    items_.push_back(Item<T>{next_seq_++, std::move(value)});
+    return queue_->push_many(items_.begin(), items_.end()) == 1;
+  }
+  // ordered时, 等到编号为begin的输入与下一个应该输出的输入相差不到limit,
+  // 这样暂存在pending_中的输入最多limit个(再加上各个worker手中的一批).
+  // 排在最前面的一批总是可以继续, 所以不会死锁. 关闭之后返回false.
+  bool WaitForWindow(int64_t begin, int64_t limit) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    window_.wait(lock, [&] { return closed_ || begin - next_input_ < limit; });
+    return !closed_;
+  }
+  // values是编号为[begin, end)的输入对应的输出. ordered时先暂存,
+  // 等前面的输入都输出之后再放入队列.
+  bool Emit(int64_t begin, int64_t end, std::vector<T>& values,
+            bool ordered) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ordered) { return this->PushLocked(values); }
+    if (begin != next_input_) {
+      pending_.emplace(begin, std::make_pair(end, std::move(values)));
+      return true;
+    }
+    bool ok = this->PushLocked(values);
+    next_input_ = end;
+    while (ok && !pending_.empty() && pending_.begin()->first == next_input_) {
+      auto node = pending_.begin();
+      ok = this->PushLocked(node->second.second);
+      next_input_ = node->second.first;
+      pending_.erase(node);
+    }
+    window_.notify_all();
+    return ok;
+  }
+
+ private:
+  bool PushLocked(std::vector<T>& values) {
+    items_.clear();
+    for (auto& value : values) {
+      items_.push_back(Item<T>{next_seq_++, std::move(value)});
+    }
+    auto pushed = queue_->push_many(items_.begin(), items_.end());
+    return pushed == int(items_.size());
+  }
+
+  std::unique_ptr<Queue> queue_;
+  std::mutex mutex_;
+  std::condition_variable window_;
+  bool closed_ = false;
+  int64_t next_seq_ = 0;    // 下一个输出的编号
+  int64_t next_input_ = 0;  // ordered时下一个应该输出的输入编号
+  std::map<int64_t, std::pair<int64_t, std::vector<T>>> pending_;
+  std::vector<Item<T>> items_;
+};
+
+class Core;
+
+class StageBase {
+ public:
+  StageBase(Core* core, const PipelineStageOptions& options)
+      : core_(core), options_(options) {}
+  DISABLE_COPY_ASIGN(StageBase);
+  DISABLE_MOVE_ASIGN(StageBase);
+  virtual ~StageBase() = default;
+
+  const PipelineStageOptions& options() const { return options_; }
+  // worker的主循环, 输入关闭并且取完, 或者流水线被取消之后返回
+  virtual void Run() = 0;
+  virtual int queue_size() const = 0;
+
+  void Prepare(int index) {
+    options_.parallelism = std::max(options_.parallelism, 1);
+    options_.batch_size = std::max(options_.batch_size, 1);
+    if (options_.name.empty()) {
+      options_.name = "stage" + std::to_string(index);
+    }
+    running_ = options_.parallelism;
+  }
+  double busy_ratio(double elapsed_seconds) const {
+    if (elapsed_seconds <= 0) { return 0.0; }
+    double busy = double(busy_ns_.load(std::memory_order_relaxed)) / 1e9;
+    return busy / (elapsed_seconds * options_.parallelism);
+  }
+  Json::Value GetMetrics(double elapsed_seconds) const {
+    Json::Value root;
+    root["name"] = options_.name;
+    root["parallelism"] = options_.parallelism;
+    root["processed"] = Json::Int64(processed_.load());
+    root["emitted"] = Json::Int64(emitted_.load());
+    root["rate"] = rate_.ToJson();
+    root["busy_ratio"] = this->busy_ratio(elapsed_seconds);
+    root["queue_size"] = this->queue_size();
+    root["queue_capacity"] = options_.queue_capacity;
+    return root;
+  }
+
+ protected:
+  Core* core_;
+  PipelineStageOptions options_;
+  std::atomic<int> running_{0};  // 还在运行的worker数
+  std::atomic<int64_t> processed_{0};
+  std::atomic<int64_t> emitted_{0};
+  std::atomic<int64_t> busy_ns_{0};  // 所有worker花在f上的时间
+  RateMeter rate_;                   // 输入的处理速率
+};
+
+// 所有stage共享的状态
+class Core {
+ public:
+  bool cancelled() const { return cancelled_.load(std::memory_order_acquire); }
+
+  void Cancel() {
+    cancelled_.store(true, std::memory_order_release);
+    for (auto& close : closers_) { close(); }
+  }
+  void Fail(std::exception_ptr error) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) { error_ = error; }
+    }
+    this->Cancel();
+  }
+  void Start(int workers) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    started_ = true;
+    running_ = workers;
+  }
+  void WorkerDone() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--running_ == 0) { condition_.notify_all(); }
+  }
+  // 等待所有worker退出, 返回第一个异常
+  std::exception_ptr Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] { return running_ == 0; });
+    return error_;
+  }
+
+  template <class T> Emitter<T>* AddEmitter() {
+    auto emitter = std::make_shared<Emitter<T>>();
+    emitters_.push_back(emitter);
+    closers_.push_back([emitter] { emitter->Close(); });
+    return emitter.get();
+  }
+
+  bool started() const { return started_; }
+
+  std::vector<std::unique_ptr<StageBase>> stages;
+  int unconnected = 0;  // 还没有接下游的输出端个数
+
+ private:
+  bool started_ = false;
+  int running_ = 0;  // 还在运行的worker数
+  std::atomic<bool> cancelled_{false};
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::exception_ptr error_;
+  std::vector<std::shared_ptr<void>> emitters_;
+  std::vector<std::function<void()>> closers_;
+};
+
+template <class In, class Out> class Stage : public StageBase {
+ public:
+  using Function = std::function<void(std::vector<In>&, std::vector<Out>&)>;
+  static constexpr bool kIsSink = std::is_same<Out, Empty>::value;
+
+  Stage(Core* core, Emitter<In>* input, Function function,
+        const PipelineStageOptions& options)
+      : StageBase(core, options), input_(input), function_(function) {
+    if (!kIsSink) { output_ = core->AddEmitter<Out>(); }
+  }
+
+  Emitter<Out>* output() const { return output_; }
+  int queue_size() const override { return input_->queue()->size(); }
+
+  void Run() override {
+    auto* queue = input_->queue();
+    const int batch_size = options_.batch_size;
+    const bool fill = batch_size > 1 && options_.batch_timeout.count() > 0;
+    std::vector<Item<In>> items;
+    std::vector<In> inputs;
+    std::vector<Out> outputs;
+    while (!core_->cancelled()) {
+      items.clear();
+      {
+        // ordered时一批的编号必须连续, 凑批期间不能让其他worker插进来
+        std::unique_lock<std::mutex> lock(pop_mutex_, std::defer_lock);
+        if (options_.ordered && fill) { lock.lock(); }
+        if (queue->pop_many(items, batch_size) == 0) { break; }
+        if (fill && int(items.size()) < batch_size) {
+          queue->pop_many_for(items, batch_size - int(items.size()),
+                              options_.batch_timeout);
+        }
+      }
+      if (core_->cancelled()) { break; }
+      if constexpr (!kIsSink) {
+        // 前面的某一批处理得很慢时, 不让其他worker无限地往前跑
+        if (options_.ordered &&
+            !output_->WaitForWindow(items.front().seq,
+                                    options_.queue_capacity)) {
+          break;
+        }
+      }
+      inputs.clear();
+      for (auto& item : items) { inputs.push_back(std::move(item.value)); }
+      outputs.clear();
+      auto start = std::chrono::steady_clock::now();
+      try {
+        function_(inputs, outputs);
+      } catch (...) {
+        core_->Fail(std::current_exception());
+        break;
+      }
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      busy_ns_.fetch_add(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+          std::memory_order_relaxed);
+      processed_.fetch_add(int64_t(items.size()), std::memory_order_relaxed);
+      emitted_.fetch_add(int64_t(outputs.size()), std::memory_order_relaxed);
+      rate_.Mark(int64_t(items.size()));
+      if constexpr (!kIsSink) {
+        if (!output_->Emit(items.front().seq, items.back().seq + 1, outputs,
+                           options_.ordered)) {
+          break;
+        }
+      }
+    }
+    // 最后一个退出的worker负责关闭下游
+    if (running_.fetch_sub(1) == 1) {
+      if constexpr (!kIsSink) { output_->Close(); }
+    }
+  }
+
+ private:
+  Emitter<In>* input_;
+  Emitter<Out>* output_ = nullptr;
+  Function function_;
+  std::mutex pop_mutex_;
+};
+
+}  // namespace pipeline_internal
+
+// 流水线中某一级的输出, 用于接下一级
+template <class T> class PipelineStream {
+ public:
+  using Options = PipelineStageOptions;
+
+  template <class F> auto Then(F f, const Options& options = Options());
+  template <class F> auto ThenBatch(F f, const Options& options = Options());
+  template <class F> void Sink(F f, const Options& options = Options());
+  template <class F> void SinkBatch(F f, const Options& options = Options());
+
+ protected:
+  PipelineStream(pipeline_internal::Core* core,
+                 pipeline_internal::Emitter<T>* emitter)
+      : core_(core), emitter_(emitter) {}
+
+  pipeline_internal::Core* core_;
+  pipeline_internal::Emitter<T>* emitter_;
+
+ private:
+  template <class> friend class PipelineStream;
+
+  template <class Out>
+  PipelineStream<Out> AddStage(
+      std::function<void(std::vector<T>&, std::vector<Out>&)> function,
+      const Options& options);
+};
+
+// 流水线的输入端, In为Push的数据类型
+template <class In> class Pipeline : public PipelineStream<In> {
+ public:
+  Pipeline() : Pipeline(std::make_unique<pipeline_internal::Core>()) {}
+  DISABLE_COPY_ASIGN(Pipeline);
+  DISABLE_MOVE_ASIGN(Pipeline);
+  // 没有Wait的话先Cancel, 不会阻塞在未处理完的数据上
+  ~Pipeline();
+
+  // 启动所有worker, 之后不能再添加stage. Start之前也可以Push,
+  // 数据先留在第一级的输入队列中.
+  void Start();
+  // 输入队列满的时候阻塞, Close或者Cancel之后返回false. 可以在多个线程中调用.
+  bool Push(In value);
+  // 不再有输入, 各级处理完剩余的数据之后依次结束
+  void Close();
+  // 丢弃所有未处理的数据, 尽快结束
+  void Cancel();
+  // 等待所有worker结束, 重新抛出stage中的第一个异常
+  void Wait();
+
+  // 每一级的处理量, 速率, 忙碌程度(busy_ratio, 接近1说明这一级的worker
+  // 一直在工作)和输入队列的长度. bottleneck为busy_ratio最高的一级,
+  // 增加它的parallelism通常能提高整体吞吐量.
+  Json::Value GetMetrics() const;
+
+ private:
+  explicit Pipeline(std::unique_ptr<pipeline_internal::Core> core)
+      : PipelineStream<In>(core.get(), core->AddEmitter<In>()),
+        owner_(std::move(core)) {
+    owner_->unconnected = 1;
+  }
+
+  std::unique_ptr<pipeline_internal::Core> owner_;
+  std::unique_ptr<ThreadPool> pool_;
+  std::chrono::steady_clock::time_point start_time_;
+  bool waited_ = false;
+};
+
+//////////////////////////////// implementation ////////////////////////////////
+
+template <class T>
+template <class Out>
+PipelineStream<Out> PipelineStream<T>::AddStage(
+    std::function<void(std::vector<T>&, std::vector<Out>&)> function,
+    const Options& options) {
+  using pipeline_internal::Empty;
+  CHECK(!core_->started()) << "Pipeline is already started.";
+  CHECK(!emitter_->is_open()) << "each stream can only have one consumer.";
+  // sink没有下游, 多个worker同时调用f时无法保证顺序
+  constexpr bool kIsSink = std::is_same<Out, Empty>::value;
+  CHECK(!kIsSink || !options.ordered || options.parallelism <= 1)
+      << "ordered sink must have parallelism 1: " << options.name;
+  emitter_->Open(options.queue_capacity);
+  auto* stage = new pipeline_internal::Stage<T, Out>(core_, emitter_,
+                                                     function, options);
+  core_->stages.emplace_back(stage);
+  core_->unconnected += kIsSink ? -1 : 0;
+  return PipelineStream<Out>(core_, stage->output());
+}
+
+template <class T>
+template <class F>
+auto PipelineStream<T>::Then(F f, const Options& options) {
+  using R = std::decay_t<std::invoke_result_t<F&, T&&>>;
+  if constexpr (pipeline_internal::IsOptional<R>::value) {
+    using Out = typename R::value_type;
+    auto function = [f](std::vector<T>& inputs,
+                        std::vector<Out>& outputs) mutable {
+      for (auto& input : inputs) {
+        auto output = f(std::move(input));
+        if (output) { outputs.push_back(std::move(*output)); }
+      }
+    };
+    return this->template AddStage<Out>(function, options);
+  } else {
+    auto function = [f](std::vector<T>& inputs,
+                        std::vector<R>& outputs) mutable {
+      for (auto& input : inputs) { outputs.push_back(f(std::move(input))); }
+    };
+    return this->template AddStage<R>(function, options);
+  }
+}
+
+template <class T>
+template <class F>
+auto PipelineStream<T>::ThenBatch(F f, const Options& options) {
+  using R = std::decay_t<std::invoke_result_t<F&, std::vector<T>&&>>;
+  using Out = typename R::value_type;
+  auto function = [f](std::vector<T>& inputs,
+                      std::vector<Out>& outputs) mutable {
+    outputs = f(std::move(inputs));
+  };
+  return this->template AddStage<Out>(function, options);
+}
+
+template <class T>
+template <class F>
+void PipelineStream<T>::Sink(F f, const Options& options) {
+  using pipeline_internal::Empty;
+  auto function = [f](std::vector<T>& inputs, std::vector<Empty>&) mutable {
+    for (auto& input : inputs) { f(std::move(input)); }
+  };
+  this->template AddStage<Empty>(function, options);
+}
+
+template <class T>
+template <class F>
+void PipelineStream<T>::SinkBatch(F f, const Options& options) {
+  using pipeline_internal::Empty;
+  auto function = [f](std::vector<T>& inputs, std::vector<Empty>&) mutable {
+    f(std::move(inputs));
+  };
+  this->template AddStage<Empty>(function, options);
+}
+
+template <class In> Pipeline<In>::~Pipeline() {
+  if (!this->core_->started() || waited_) { return; }
+  this->core_->Cancel();
+  this->core_->Wait();
+}
+
+template <class In> void Pipeline<In>::Start() {
+  CHECK(!this->core_->started()) << "Pipeline is already started.";
+  CHECK_EQ(this->core_->unconnected, 0) << "Pipeline must end with a Sink.";
+  int total = 0;
+  for (size_t i = 0; i < this->core_->stages.size(); ++i) {
+    this->core_->stages[i]->Prepare(int(i));
+    total += this->core_->stages[i]->options().parallelism;
+  }
+  this->core_->Start(total);
+  start_time_ = std::chrono::steady_clock::now();
+  pool_.reset(new ThreadPool(total));
+  auto* core = this->core_;
+  for (auto& stage : this->core_->stages) {
+    auto* pointer = stage.get();
+    for (int i = 0; i < stage->options().parallelism; ++i) {
+      pool_->post([core, pointer] {
+        pointer->Run();
+        core->WorkerDone();
+      });
+    }
+  }
+}
+
+template <class In> bool Pipeline<In>::Push(In value) {
+  CHECK(this->emitter_->is_open()) << "add stages before Push.";
+  if (this->core_->cancelled()) { return false; }
+  return this->emitter_->Push(std::move(value));
+}
+
+template <class In> void Pipeline<In>::Close() { this->emitter_->Close(); }
+
+template <class In> void Pipeline<In>::Cancel() { this->core_->Cancel(); }
+
+template <class In> void Pipeline<In>::Wait() {
+  CHECK(this->core_->started()) << "Pipeline is not started yet.";
+  auto error = this->core_->Wait();
+  waited_ = true;
+  if (error) { std::rethrow_exception(error); }
+}
+
+template <class In> Json::Value Pipeline<In>::GetMetrics() const {
+  using Seconds = std::chrono::duration<double>;
+  double elapsed = 0.0;
+  if (this->core_->started()) {
+    elapsed = Seconds(std::chrono::steady_clock::now() - start_time_).count();
+  }
+  Json::Value root;
+  root["elapsed_seconds"] = elapsed;
+  root["stages"] = Json::Value(Json::arrayValue);
+  std::string bottleneck;
+  double max_ratio = -1.0;
+  for (const auto& stage : this->core_->stages) {
+    root["stages"].append(stage->GetMetrics(elapsed));
+    double ratio = stage->busy_ratio(elapsed);
+    if (ratio > max_ratio) {
+      max_ratio = ratio;
+      bottleneck = stage->options().name;
+    }
+  }
+  root["bottleneck"] = bottleneck;
+  return root;
+}
+
+#endif  // PUBLIC_PIPELINE_H_
@@ -0,0 +1,159 @@
+#ifndef PUBLIC_POOL_ALLOCATOR_H_
+#define PUBLIC_POOL_ALLOCATOR_H_
+
+#include "common.h"
+
+// 按大小分级的内存块池, 用于频繁分配和释放小对象的场景, 比如ThreadPool中
+// 每个任务的promise状态. 每个线程有一个本地缓存, 本地缓存空了从全局链表
+// 成批领取, 多了成批归还, 只有成批转移的时候才加锁. 块在一个线程分配,
+// 在另一个线程释放也没有问题. 从系统申请的内存不再归还, 所以只适合数量
+// 有上限的对象. 超过kMaxSize的请求直接使用operator new.
+class BlockPool {
+ public:
+  static constexpr size_t kAlignment = alignof(std::max_align_t);
+  static constexpr size_t kMaxSize = 256;
+
+  static void* Allocate(size_t size);
+  static void Deallocate(void* block, size_t size);
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+  // 全局链表, 一次转移kBatch个块
+  struct Central {
+    std::mutex mutex;
+    FreeBlock* head = nullptr;
+    size_t count = 0;
+  };
+  struct LocalCache {
+    FreeBlock* heads[kMaxSize / kAlignment] = {};
+    size_t counts[kMaxSize / kAlignment] = {};
+    ~LocalCache();
+  };
+
+  static constexpr size_t kNumClasses = kMaxSize / kAlignment;
+  static constexpr size_t kBatch = 32;
+
+  static size_t ClassIndex(size_t size) {
+    return (size + kAlignment - 1) / kAlignment - 1;
+  }
+  static Central* GetCentral() {
+    // 故意不析构, 其他线程退出时还可能往里面归还
+    static Central* central = new Central[kNumClasses];
+    return central;
+  }
+  static LocalCache& GetLocalCache() {
+    thread_local LocalCache cache;
+    return cache;
+  }
+  static FreeBlock* Fetch(size_t index, size_t& count);
+  static void Release(size_t index, FreeBlock* head, size_t count);
+};
+
+// 使用BlockPool的标准分配器, 可以用于std::allocate_shared,
+// std::promise(std::allocator_arg, ...)等.
+template <class T> class PoolAllocator {
+ public:
+  using value_type = T;
+
+  PoolAllocator() = default;
+  template <class U> PoolAllocator(const PoolAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(BlockPool::Allocate(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) { BlockPool::Deallocate(p, n * sizeof(T)); }
+
+  template <class U> bool operator==(const PoolAllocator<U>&) const {
+    return true;
+  }
+  template <class U> bool operator!=(const PoolAllocator<U>&) const {
+    return false;
+  }
+};
+
+//////////////////////////////// implementation ////////////////////////////////
+
+inline void* BlockPool::Allocate(size_t size) {
+  if (size == 0 || size > kMaxSize) { return ::operator new(size); }
+  auto index = ClassIndex(size);
+  auto& cache = GetLocalCache();
+  if (cache.heads[index] == nullptr) {
+    cache.heads[index] = Fetch(index, cache.counts[index]);
+  }
+  auto* block = cache.heads[index];
+  cache.heads[index] = block->next;
+  --cache.counts[index];
+  return block;
+}
+
+inline void BlockPool::Deallocate(void* block, size_t size) {
+  if (size == 0 || size > kMaxSize) { return ::operator delete(block); }
+  auto index = ClassIndex(size);
+  auto& cache = GetLocalCache();
+  auto* head = static_cast<FreeBlock*>(block);
+  head->next = cache.heads[index];
+  cache.heads[index] = head;
+  if (++cache.counts[index] < kBatch * 2) { return; }
+  // 本地缓存太多, 把前kBatch个还给全局链表
+  auto* tail = head;
+  for (size_t i = 1; i < kBatch; ++i) { tail = tail->next; }
+  cache.heads[index] = tail->next;
+  cache.counts[index] -= kBatch;
+  tail->next = nullptr;
+  Release(index, head, kBatch);
+}
+
+// 从全局链表领取至多kBatch个块, 全局链表为空时一次向系统申请kBatch个
+inline BlockPool::FreeBlock* BlockPool::Fetch(size_t index, size_t& count) {
+  auto& central = GetCentral()[index];
+  {
+    std::lock_guard<std::mutex> lock(central.mutex);
+    if (central.head != nullptr) {
+      auto* head = central.head;
+      auto* tail = head;
+      count = 1;
+      while (count < kBatch && tail->next != nullptr) {
+        tail = tail->next;
+        ++count;
+      }
+      central.head = tail->next;
+      central.count -= count;
+      tail->next = nullptr;
+      return head;
+    }
+  }
+  const size_t block_size = (index + 1) * kAlignment;
+  auto* chunk = static_cast<char*>(::operator new(block_size * kBatch));
+  FreeBlock* head = nullptr;
+  for (size_t i = kBatch; i > 0; --i) {
+    auto* block = reinterpret_cast<FreeBlock*>(chunk + (i - 1) * block_size);
+    block->next = head;
+    head = block;
+  }
+  count = kBatch;
+  return head;
+}
+
+inline void BlockPool::Release(size_t index, FreeBlock* head, size_t count) {
+  if (head == nullptr) { return; }
+  auto* tail = head;
+  while (tail->next != nullptr) { tail = tail->next; }
+  auto& central = GetCentral()[index];
+  std::lock_guard<std::mutex> lock(central.mutex);
+  tail->next = central.head;
+  central.head = head;
+  central.count += count;
+}
+
+// 线程退出时把本地缓存全部还给全局链表
+inline BlockPool::LocalCache::~LocalCache() {
+  for (size_t i = 0; i < kNumClasses; ++i) {
+    Release(i, heads[i], counts[i]);
+    heads[i] = nullptr;
+    counts[i] = 0;
+  }
+}
+
+#endif  // PUBLIC_POOL_ALLOCATOR_H_
@@ -0,0 +1,252 @@
+#ifndef PUBLIC_RING_QUEUE_H_
+#define PUBLIC_RING_QUEUE_H_
+
+#include "common.h"
+
+// 有界多生产者多消费者无锁队列, 接口和语义与BlockingQueue一致.
+// 算法参考: https://www.1024cores.net/home/lock-free-algorithms/queues/
+//           bounded-mpmc-queue
+// 每个slot带一个序号, 生产者和消费者通过CAS抢占位置, 然后通过序号交接数据.
+// 存储空间在构造时一次性分配, 运行过程中不再分配内存. 阻塞版本的push/pop
+// 先自旋, 再让出cpu, 最后才挂起在条件变量上; 只有确实有线程挂起的时候,
+// 对端才会去碰mutex, 所以正常流转的时候没有futex调用.
+template <class T> class RingQueue {
+ public:
+  // capacity会被向上取整到2的幂
+  explicit RingQueue(int capacity);
+  DISABLE_COPY_ASIGN(RingQueue);
+  DISABLE_MOVE_ASIGN(RingQueue);
+  ~RingQueue();
+
+  // 下面这些获取队列状态的函数获取的只是当前的队列状态, 在多线程的情况下
+  // 容易产生race condition, 使用的时候需要特别注意.
+  bool full() const { return this->size() >= this->capacity(); }
+  bool empty() const { return this->size() <= 0; }
+  int size() const {
+    auto head = dequeue_pos_.load(std::memory_order_relaxed);
+    auto tail = enqueue_pos_.load(std::memory_order_relaxed);
+    return tail > head ? int(tail - head) : 0;
+  }
+  // 直接在slot中析构, 不要求T可以默认构造
+  void clear() {
+    while (this->TryConsume([](T&) {})) {}
+  }
+  int capacity() const { return int(mask_ + 1); }
+
+  // 非阻塞版本, 队列满/空或者已经abort时立即返回false.
+  // try_push失败时value保持不变.
+  bool try_push(T& value);
+  bool try_push(T&& value) { return this->try_push(value); }
+  bool try_pop(T& value);
+
+  bool push(T value);
+  bool pop(T& value);
+  void abort();
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    T* get() { return reinterpret_cast<T*>(&storage); }
+  };
+
+  // 自旋和让出cpu的次数, 超过之后挂起
+  static constexpr int kSpinCount = 128;
+  static constexpr int kYieldCount = 16;
+  static constexpr size_t kCacheLine = 64;
+
+  static void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+  }
+
+  bool TryPush(T& value);
+  bool TryPop(T& value) {
+    return this->TryConsume([&value](T& slot) { value = std::move(slot); });
+  }
+  // 抢到一个slot之后对其中的元素调用consume, 然后析构
+  template <class F> bool TryConsume(F&& consume);
+  // 只是探测, 不修改队列
+  bool CanPush() const;
+  bool CanPop() const;
+  void Wait(std::condition_variable& condition, std::atomic<int>& waiters,
+            bool (RingQueue::*ready)() const);
+  void Notify(std::condition_variable& condition, std::atomic<int>& waiters);
+
+  size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(kCacheLine) std::atomic<size_t> enqueue_pos_{0};
+  alignas(kCacheLine) std::atomic<size_t> dequeue_pos_{0};
+  alignas(kCacheLine) std::atomic<bool> aborted_{false};
+  std::atomic<int> push_waiters_{0};
+  std::atomic<int> pop_waiters_{0};
+  std::mutex mutex_;
+  std::condition_variable condition_pop_;
+  std::condition_variable condition_push_;
+};
+
+template <class T>  // NOFORMAT(:1)
+using RingQueuePtr = std::shared_ptr<RingQueue<T>>;
+
+//////////////////////////////// implementation ////////////////////////////////
+
+template <class T> RingQueue<T>::RingQueue(int capacity) {
+  CHECK_GT(capacity, 0) << "Invalid capacity: " << capacity;
+  size_t size = 1;
+  while (size < size_t(capacity)) { size <<= 1; }
+  mask_ = size - 1;
+  slots_.reset(new Slot[size]);
+  for (size_t i = 0; i < size; ++i) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template <class T> RingQueue<T>::~RingQueue() {
+  this->abort();
+  this->clear();
+}
+
+template <class T> bool RingQueue<T>::TryPush(T& value) {
+  auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    Slot& slot = slots_[pos & mask_];
+    auto seq = slot.sequence.load(std::memory_order_acquire);
+    auto diff = intptr_t(seq) - intptr_t(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        new (slot.get()) T(std::move(value));
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;  // 队列已满
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class T>
+template <class F>
+bool RingQueue<T>::TryConsume(F&& consume) {
+  auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    Slot& slot = slots_[pos & mask_];
+    auto seq = slot.sequence.load(std::memory_order_acquire);
+    auto diff = intptr_t(seq) - intptr_t(pos + 1);
+    if (diff == 0) {
+      if (dequeue_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        consume(*slot.get());
+        slot.get()->~T();
+        slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;  // 队列为空
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class T> bool RingQueue<T>::CanPush() const {
+  auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+  auto seq = slots_[pos & mask_].sequence.load(std::memory_order_acquire);
+  return intptr_t(seq) - intptr_t(pos) >= 0;
+}
+
+template <class T> bool RingQueue<T>::CanPop() const {
+  auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+  auto seq = slots_[pos & mask_].sequence.load(std::memory_order_acquire);
+  return intptr_t(seq) - intptr_t(pos + 1) >= 0;
+}
+
+template <class T>
+void RingQueue<T>::Wait(std::condition_variable& condition,
+                        std::atomic<int>& waiters,
+                        bool (RingQueue::*ready)() const) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  waiters.fetch_add(1);
+  // 与Notify中的fence配对: 要么这里看到对端的修改, 要么对端看到waiters
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  condition.wait(lock, [this, ready] {
+    return aborted_.load() || (this->*ready)();
+  });  // NOFORMAT(-2:)
+  waiters.fetch_sub(1);
+}
+
+template <class T>
+void RingQueue<T>::Notify(std::condition_variable& condition,
+                          std::atomic<int>& waiters) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters.load(std::memory_order_relaxed) > 0) {
+    // 加锁保证等待的线程要么还没检查条件, 要么已经进入wait
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    condition.notify_one();
+  }
+}
+
+template <class T> bool RingQueue<T>::try_push(T& value) {
+  if (aborted_.load(std::memory_order_acquire)) { return false; }
+  if (!this->TryPush(value)) { return false; }
+  this->Notify(condition_pop_, pop_waiters_);
+  return true;
+}
+
+template <class T> bool RingQueue<T>::try_pop(T& value) {
+  if (!this->TryPop(value)) { return false; }
+  this->Notify(condition_push_, push_waiters_);
+  return true;
+}
+
+template <class T> bool RingQueue<T>::push(T value) {
+  for (int round = 0;; ++round) {
+    if (aborted_.load(std::memory_order_acquire)) { return false; }
+    if (this->TryPush(value)) { break; }
+    if (round < kSpinCount) {
+      CpuRelax();
+    } else if (round < kSpinCount + kYieldCount) {
+      std::this_thread::yield();
+    } else {
+      this->Wait(condition_push_, push_waiters_, &RingQueue::CanPush);
+    }
+  }
+  this->Notify(condition_pop_, pop_waiters_);
+  return true;
+}
+
+template <class T> bool RingQueue<T>::pop(T& value) {
+  for (int round = 0;; ++round) {
+    if (this->TryPop(value)) { break; }
+    if (aborted_.load(std::memory_order_acquire)) {
+      // abort之后仍然可以取走剩余的数据, 与BlockingQueue保持一致
+      if (!this->TryPop(value)) { return false; }
+      break;
+    }
+    if (round < kSpinCount) {
+      CpuRelax();
+    } else if (round < kSpinCount + kYieldCount) {
+      std::this_thread::yield();
+    } else {
+      this->Wait(condition_pop_, pop_waiters_, &RingQueue::CanPop);
+    }
+  }
+  this->Notify(condition_push_, push_waiters_);
+  return true;
+}
+
+template <class T> void RingQueue<T>::abort() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    aborted_.store(true);
+  }
+  condition_pop_.notify_all();
+  condition_push_.notify_all();
+}
+
+#endif  // PUBLIC_RING_QUEUE_H_
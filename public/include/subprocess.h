@@ -0,0 +1,89 @@
+#ifndef PUBLIC_SUBPROCESS_H_
+#define PUBLIC_SUBPROCESS_H_
+
+#include <signal.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "thread_pool.h"
+
+// 子进程的运行结果
+struct SubprocessResult {
+  bool started = false;    // posix_spawn是否成功
+  bool timed_out = false;  // 是否因为超时被kill
+  int exit_code = -1;      // 正常退出时的返回值, 否则为-1
+  int signal = 0;          // 被信号终止时的信号
+  std::string out;         // 捕获的stdout
+  std::string err;         // 捕获的stderr
+
+  bool ok() const { return started && exit_code == 0; }
+};
+
+struct SubprocessOptions {
+  // 超过timeout还没有结束的进程会被SIGKILL, 0表示不限时间
+  std::chrono::milliseconds timeout{0};
+  // 不捕获时子进程直接继承当前进程的stdout/stderr
+  bool capture_stdout = true;
+  bool capture_stderr = true;
+  // 默认stdin为/dev/null, 为true时子进程继承当前进程的stdin
+  bool inherit_stdin = false;
+};
+
+// 通过posix_spawnp直接运行argv, 不经过shell, 也不需要fork整个进程.
+// stdout和stderr通过非阻塞的管道读取, 每次最多读64KB; stdin默认为/dev/null.
+//   auto result = Subprocess::Run({"ls", "-l", dir});
+//   if (result.ok()) { ... result.out ... }
+//
+// 也可以先Start, 在Wait之前随时Kill:
+//   Subprocess process({"sleep", "100"});
+//   process.Start();
+//   process.Kill();
+//   auto result = process.Wait();
+class Subprocess {
+ public:
+  using Options = SubprocessOptions;
+
+  explicit Subprocess(std::vector<std::string> argv,
+                      const Options& options = Options());
+  DISABLE_COPY_ASIGN(Subprocess);
+  DISABLE_MOVE_ASIGN(Subprocess);
+  // 启动了但还没有Wait的进程会被kill, 不会留下僵尸进程
+  ~Subprocess();
+
+  // 启动子进程, 失败(比如找不到可执行文件)返回false
+  bool Start();
+  // 读取所有输出并等待进程结束或者超时. 只能调用一次.
+  SubprocessResult Wait();
+  // 向正在运行的子进程发送信号, 可以在其他线程中调用
+  void Kill(int signal = SIGKILL);
+
+  pid_t pid() const { return pid_; }
+
+  // Start + Wait
+  static SubprocessResult Run(std::vector<std::string> argv,
+                              const Options& options = Options());
+
+  // 在pool中批量运行, 同时运行的进程数不超过max_concurrency,
+  // max_concurrency <= 0时为pool.size() + 1(调用线程也参与).
+  // 结果与commands一一对应.
+  static std::vector<SubprocessResult> RunAll(
+      const std::vector<std::vector<std::string>>& commands, ThreadPool& pool,
+      const Options& options = Options(), int max_concurrency = 0);
+
+ private:
+  void CloseFds();
+
+  std::vector<std::string> argv_;
+  Options options_;
+  pid_t pid_ = -1;
+  bool waited_ = false;
+  std::mutex mutex_;  // 保护reaped_, 以及kill和waitpid之间的顺序
+  bool reaped_ = false;
+  int out_fd_ = -1;
+  int err_fd_ = -1;
+  int pid_fd_ = -1;  // 用于poll进程的退出, 内核不支持时为-1
+  std::chrono::steady_clock::time_point start_time_;
+  SubprocessResult result_;
+};
+
+#endif  // PUBLIC_SUBPROCESS_H_
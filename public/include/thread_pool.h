@@ -2,61 +2,622 @@
 #define PUBLIC_THREAD_POOL_H_
 
 #include "common.h"
+#include "cpu_topology.h"
+#include "inline_task.h"
+#include "pool_allocator.h"
+#include "timer.h"
+
+// ThreadPool的可选配置
+struct ThreadPoolOptions {
+  // worker的线程名为"<name>-<序号>", 为空时不设置
+  std::string name;
+  // worker i绑定到cpus[i % cpus.size()]. 为空时按affinity从
+  // CpuTopology::Get()中选取, affinity为kNone时不绑定.
+  std::vector<int> cpus;
+  CpuAffinity affinity = CpuAffinity::kNone;
+  // false时所有worker都绑定到整个cpus列表, 只限制运行的范围(比如一个
+  // NUMA节点), 具体在哪个cpu上由调度器决定
+  bool pin_each = true;
+};
 
 // copy from: https://github.com/progschj/ThreadPool
 class ThreadPool {
  public:
-  explicit ThreadPool(int num_threads);
+  // kShared: 所有worker共用一个任务队列, 任务严格按FIFO顺序被取走.
+  // kWorkStealing: 每个worker有自己的双端队列, worker内部提交的任务进入
+  // 本地队列, 外部提交的任务轮流分配给各个worker, 空闲的worker从其他
+  // worker的队列头部窃取任务. 适用于线程数多, 任务小而密集的场景.
+  enum class Mode { kShared, kWorkStealing };
+
+  // 绑定失败(比如cpu不在cgroup允许的范围内)时只打印警告, worker照常运行
+  explicit ThreadPool(int num_threads, Mode mode = Mode::kShared,
+                      const ThreadPoolOptions& options = ThreadPoolOptions());
   DISABLE_COPY_ASIGN(ThreadPool);
   DISABLE_MOVE_ASIGN(ThreadPool);
   ~ThreadPool();
 
+  // 任务本身存放在InlineTask中, future的共享状态从BlockPool中分配,
+  // 任务队列是不缩小的环形缓冲区, 所以稳定运行时提交任务不分配内存.
   template <class F, class... Args>
   auto enqueue(F&& f, Args&&... args)
       -> std::future<typename std::result_of<F(Args...)>::type>;
+  // 不需要结果的任务, 不创建future, 开销比enqueue更小.
+  // f抛出的异常会被记录到日志, 然后忽略.
+  template <class F, class... Args> void post(F&& f, Args&&... args);
+
+  // 带优先级和截止时间的任务放在一个按rank排序的堆中, rank越小越先执行:
+  //   enqueue的任务: rank = 提交时间, 即FIFO.
+  //   enqueue_with_priority: rank = 提交时间 - priority * aging_interval.
+  //     priority越大越先执行, 可以为负数. 由于rank中包含提交时间, 低优先级的
+  //     任务排队越久越靠前, 不会被饿死.
+  //   enqueue_with_deadline: rank = deadline - deadline_slack, 即最早截止时间
+  //     优先(EDF), 并且在截止时间之前slack就开始优先于之后提交的普通任务.
+  // kShared模式下worker总是取所有任务中rank最小的一个. kWorkStealing模式下
+  // 普通任务分散在各个本地队列中, 无法精确比较, 堆中rank不大于当前时间的
+  // 任务先于本地队列被取走, 其余的在worker没有其他任务时才被取走.
+  template <class F, class... Args>
+  auto enqueue_with_priority(int priority, F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+  template <class C, class D, class F, class... Args>
+  auto enqueue_with_deadline(std::chrono::time_point<C, D> deadline, F&& f,
+                             Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+
+  // 开启之后, 出队时已经超过截止时间的任务会被直接丢弃,
+  // 对应的future抛出std::future_error(broken_promise). 默认关闭.
+  void set_drop_expired(bool drop) { drop_expired_.store(drop); }
+  // 优先级每相差1, 相当于排队时间相差interval, 默认10ms
+  void set_aging_interval(std::chrono::nanoseconds interval) {
+    aging_interval_.store(interval.count());
+  }
+  // 截止时间之前多久开始优先执行, 应该大于任务本身的运行时间, 默认100ms.
+  // 为0时kWorkStealing模式下的任务要到截止时间才会先于本地队列被取走.
+  void set_deadline_slack(std::chrono::nanoseconds slack) {
+    deadline_slack_.store(slack.count());
+  }
+
+  int size() const { return int(workers_.size()); }
+  Mode mode() const { return mode_; }
+
+  // 运行状态的快照:
+  //   enqueued/enqueue_rate: 提交的任务总数, 以及自上次快照以来每秒提交的任务数
+  //   queue_depth/peak_queue_depth: 当前和历史最多的排队任务数
+  //   dropped: 因为超过截止时间而被丢弃的任务数
+  //   wait_time/run_time: 任务排队时间和执行时间的分布, 见LatencyHistogram
+  //   workers: 每个worker执行的任务数, 累计忙碌时间, 以及自上次快照以来的
+  //            忙碌时间占比(只统计已经执行完的任务), 绑定时还有所在的cpu
+  Json::Value GetMetrics();
 
  private:
+  using Task = InlineTask;
+  using Clock = TscClock;
+
+  struct PendingTask {
+    Task function;
+    Clock::time_point enqueue_time;
+    int64_t rank = 0;  // 越小越先执行
+    uint64_t sequence = 0;  // rank相同时按提交顺序
+    Clock::time_point deadline = Clock::time_point::max();
+  };
+  // 用于std::push_heap等, 使rank最小的任务位于堆顶
+  struct RankGreater {
+    bool operator()(const PendingTask& a, const PendingTask& b) const {
+      if (a.rank != b.rank) { return a.rank > b.rank; }
+      return a.sequence > b.sequence;
+    }
+  };
+
+  // 每个worker只写自己的统计, 按cache line对齐, 避免false sharing
+  struct alignas(64) WorkerStats {
+    std::atomic<int64_t> tasks{0};
+    std::atomic<int64_t> busy{0};  // 纳秒
+  };
+
+  // 环形缓冲区实现的双端队列, 容量不够时翻倍, 之后不再缩小.
+  // std::deque每存取若干个元素就要分配或释放一个节点, 这里不会.
+  class TaskBuffer {
+   public:
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    PendingTask& front() { return slots_[head_]; }
+    PendingTask& back() { return slots_[(head_ + size_ - 1) & mask_]; }
+    void push_back(PendingTask&& task) {
+      if (size_ == slots_.size()) { this->Grow(); }
+      slots_[(head_ + size_) & mask_] = std::move(task);
+      ++size_;
+    }
+    // 元素已经被move走, 只需要移动下标
+    void pop_front() {
+      head_ = (head_ + 1) & mask_;
+      --size_;
+    }
+    void pop_back() { --size_; }
+
+   private:
+    void Grow() {
+      std::vector<PendingTask> slots(std::max<size_t>(16, slots_.size() * 2));
+      for (size_t i = 0; i < size_; ++i) {
+        slots[i] = std::move(slots_[(head_ + i) & mask_]);
+      }
+      slots_.swap(slots);
+      head_ = 0;
+      mask_ = slots_.size() - 1;
+    }
+    std::vector<PendingTask> slots_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+    size_t mask_ = 0;
+  };
+
+  // work-stealing模式下每个worker的本地队列, owner从尾部存取, 其他worker
+  // 从头部窃取. 单独一把锁, 只有窃取的时候才会产生竞争.
+  struct WorkQueue {
+    std::mutex mutex;
+    TaskBuffer tasks;
+  };
+
+  // 记录当前线程是哪个pool的第几个worker, 用于把worker内部提交的任务
+  // 放入本地队列.
+  struct WorkerContext {
+    const ThreadPool* pool = nullptr;
+    int index = -1;
+  };
+  static WorkerContext& CurrentWorker() {
+    thread_local WorkerContext context;
+    return context;
+  }
+
+  // 把f和args打包成Task, 同时返回对应的future
+  template <class F, class... Args>
+  using Result = typename std::result_of<F(Args...)>::type;
+  template <class F, class... Args>
+  static auto Package(F&& f, Args&&... args)
+      -> std::pair<Task, std::future<Result<F, Args...>>>;
+  template <class R, class Fn>
+  static void Fulfill(std::promise<R>& promise, Fn& fn) {
+    try {
+      promise.set_value(fn());
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+  }
+  template <class Fn> static void Fulfill(std::promise<void>& promise, Fn& fn) {
+    try {
+      fn();
+      promise.set_value();
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+  }
+
+  static void SetupWorker(const std::string& name,
+                          const std::vector<int>& cpus);
+  void CountEnqueue();
+  void Submit(Task task);
+  void SubmitScheduled(Task task, int64_t rank, Clock::time_point deadline);
+  void WakeWorkStealing();
+  bool PopScheduled(PendingTask& task, int64_t max_rank);
+  bool TakeScheduled(PendingTask& task, int64_t max_rank);
+  void RunShared(int index);
+  void RunWorkStealing(int index);
+  bool TakeTask(int index, PendingTask& task);
+  void RunTask(int index, PendingTask& task);
+
+  Mode mode_;
   std::vector<std::thread> workers_;
-  std::queue<std::function<void()>> tasks_;
+  TaskBuffer tasks_;
   mutable std::mutex mutex_;
   std::condition_variable condition_;
   bool stop_{false};
+
+  // 带优先级和截止时间的任务, 按RankGreater组织成堆, 由mutex_保护.
+  // num_scheduled_用于在不加锁的情况下判断堆是否为空.
+  std::vector<PendingTask> scheduled_;
+  std::atomic<int64_t> num_scheduled_{0};
+  std::atomic<uint64_t> sequence_{0};
+  std::atomic<bool> drop_expired_{false};
+  std::atomic<int64_t> aging_interval_{10 * 1000 * 1000};
+  std::atomic<int64_t> deadline_slack_{100 * 1000 * 1000};
+
+  // 以下成员只在work-stealing模式下使用. pending_是所有本地队列和堆中的任务
+  // 总数, sleepers_是正在等待condition_的worker数, 二者配合使得提交任务
+  // 时只有在确实有worker休眠的情况下才需要碰mutex_.
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::atomic<int64_t> pending_{0};
+  std::atomic<int> sleepers_{0};
+  std::atomic<uint32_t> next_queue_{0};
+
+  // 以下成员用于统计运行状态, 热路径上只有relaxed的原子操作
+  std::atomic<int64_t> enqueued_{0};
+  std::atomic<int64_t> started_{0};
+  std::atomic<int64_t> dropped_{0};
+  std::atomic<int64_t> peak_depth_{0};
+  LatencyHistogram wait_time_;
+  LatencyHistogram run_time_;
+  std::unique_ptr<WorkerStats[]> worker_stats_;
+  // 上一次快照时的数据, 用于计算速率, 由metrics_mutex_保护.
+  // 快照不在热路径上, 用steady_clock, 避免构造时就触发TscClock的校准.
+  std::mutex metrics_mutex_;
+  std::chrono::steady_clock::time_point last_snapshot_{
+      std::chrono::steady_clock::now()};
+  int64_t last_enqueued_ = 0;
+  std::vector<int64_t> last_busy_;
+  // 每个worker绑定的cpu, 不绑定时为空
+  std::vector<std::vector<int>> worker_cpus_;
+};
+
+// 每个NUMA节点一个ThreadPool, worker只在本节点的cpu上运行. 任务队列本身
+// 由构造pool的线程分配, 不保证在本节点上, 节点本地的只是任务的执行.
+// 访问内存密集的任务提交到数据所在节点的pool, 数据也由这个pool中的任务
+// 分配和初始化(first-touch), 避免跨节点访问内存:
+//   NumaThreadPool pools(0, ThreadPool::Mode::kShared, "shard");
+//   for (int i = 0; i < pools.size(); ++i) {
+//     pools.pool(i).post([&shards, i] { shards[i] = LoadShard(i); });
+//   }
+class NumaThreadPool {
+ public:
+  // threads_per_node <= 0时每个节点的worker数等于节点的cpu数.
+  // 线程名为"<name><节点编号>-<序号>".
+  explicit NumaThreadPool(int threads_per_node = 0,
+                          ThreadPool::Mode mode = ThreadPool::Mode::kShared,
+                          const std::string& name = "numa",
+                          const CpuTopology& topology = CpuTopology::Get());
+  DISABLE_COPY_ASIGN(NumaThreadPool);
+  DISABLE_MOVE_ASIGN(NumaThreadPool);
+  ~NumaThreadPool() = default;
+
+  int size() const { return int(pools_.size()); }
+  ThreadPool& pool(int index) { return *pools_[index]; }
+  const NumaNode& node(int index) const { return topology_.nodes[index]; }
+  // 当前线程所在节点的pool, 用于在任务内部提交后续任务而不离开本节点.
+  // 当前cpu不属于任何节点时返回第一个pool.
+  ThreadPool& local();
+
+  // {"nodes": [{"node": 节点编号, "cpus": "0-7", "pool": pool的GetMetrics}]}
+  Json::Value GetMetrics();
+
+ private:
+  CpuTopology topology_;
+  std::vector<std::unique_ptr<ThreadPool>> pools_;
 };
 
 // the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(int num_threads) {
+inline ThreadPool::ThreadPool(int num_threads, Mode mode,
+                              const ThreadPoolOptions& options)
+    : mode_(mode),
+      worker_stats_(new WorkerStats[std::max(num_threads, 0)]),
+      last_busy_(std::max(num_threads, 0), 0),
+      worker_cpus_(std::max(num_threads, 0)) {
+  if (mode_ == Mode::kWorkStealing) {
+    CHECK_GT(num_threads, 0) << "Work-stealing pool needs at least 1 worker.";
+    for (int i = 0; i < num_threads; ++i) {
+      queues_.emplace_back(new WorkQueue());
+    }
+  }
+  auto cpus = options.cpus;
+  // 不绑定时不读取拓扑, 避免每个普通的pool都去访问sysfs
+  if (cpus.empty() && options.affinity != CpuAffinity::kNone) {
+    cpus = OrderCpus(CpuTopology::Get(), options.affinity);
+  }
+  for (int i = 0; i < num_threads && !cpus.empty(); ++i) {
+    if (options.pin_each) {
+      worker_cpus_[i] = {cpus[i % cpus.size()]};
+    } else {
+      worker_cpus_[i] = cpus;
+    }
+  }
   for (int i = 0; i < num_threads; ++i) {
-    workers_.emplace_back([this] {
-      while (true) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
-        if (stop_ && tasks_.empty()) { return; }
-        auto task = std::move(tasks_.front());
-        tasks_.pop();
-        // task运行耗时较长, 所以这里得先unlock
-        lock.unlock();
-        task();
+    std::string name = options.name;
+    if (!name.empty()) { name += "-" + std::to_string(i); }
+    workers_.emplace_back([this, i, name] {
+      SetupWorker(name, worker_cpus_[i]);
+      if (mode_ == Mode::kShared) {
+        this->RunShared(i);
+      } else {
+        this->RunWorkStealing(i);
       }
     });
   }
 }
 
+inline void ThreadPool::SetupWorker(const std::string& name,
+                                    const std::vector<int>& cpus) {
+  if (!name.empty()) { SetThreadName(name); }
+  if (!cpus.empty() && !SetThreadAffinity(cpus)) {
+    PLOG(WARNING) << "failed to bind worker " << name << " to cpus "
+                  << FormatCpuList(cpus);
+  }
+}
+
+template <class F, class... Args>
+auto ThreadPool::Package(F&& f, Args&&... args)
+    -> std::pair<Task, std::future<Result<F, Args...>>> {
+  using return_type = typename std::result_of<F(Args...)>::type;
+  // 与std::bind一样, 参数按值保存, 以左值的形式传给f
+  std::promise<return_type> promise(std::allocator_arg, PoolAllocator<char>());
+  std::future<return_type> res = promise.get_future();
+  Task task([promise = std::move(promise), f = std::forward<F>(f),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+    auto call = [&f, &args]() -> return_type { return std::apply(f, args); };
+    Fulfill(promise, call);
+  });
+  return {std::move(task), std::move(res)};
+}
+
 // add new work item to the pool
 template <class F, class... Args>
 auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
   CHECK(!stop_) << "Enqueueing is not allowed when the pool is stopped.";
+  auto package = Package(std::forward<F>(f), std::forward<Args>(args)...);
+  this->Submit(std::move(package.first));
+  return std::move(package.second);
+}
 
-  using return_type = typename std::result_of<F(Args...)>::type;
-  auto task = std::make_shared<std::packaged_task<return_type()>>(
-      std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-  std::future<return_type> res = task->get_future();
+template <class F, class... Args>
+void ThreadPool::post(F&& f, Args&&... args) {
+  CHECK(!stop_) << "Posting is not allowed when the pool is stopped.";
+  this->Submit([f = std::forward<F>(f),
+                args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+    try {
+      std::apply(f, args);
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "uncaught exception in posted task: " << e.what();
+    } catch (...) {
+      LOG(ERROR) << "uncaught unknown exception in posted task";
+    }
+  });
+}
+
+template <class F, class... Args>
+auto ThreadPool::enqueue_with_priority(int priority, F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  CHECK(!stop_) << "Enqueueing is not allowed when the pool is stopped.";
+  auto package = Package(std::forward<F>(f), std::forward<Args>(args)...);
+  auto now = Clock::now().time_since_epoch().count();
+  auto rank = now - int64_t(priority) * aging_interval_.load();
+  this->SubmitScheduled(std::move(package.first), rank,
+                        Clock::time_point::max());
+  return std::move(package.second);
+}
+
+template <class C, class D, class F, class... Args>
+auto ThreadPool::enqueue_with_deadline(std::chrono::time_point<C, D> deadline,
+                                       F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  CHECK(!stop_) << "Enqueueing is not allowed when the pool is stopped.";
+  auto package = Package(std::forward<F>(f), std::forward<Args>(args)...);
+  // 换算到Clock上, 这样调用者可以使用任意的时钟
+  auto remaining = std::chrono::duration_cast<Clock::duration>(
+      deadline - C::now());
+  auto local_deadline = Clock::now() + remaining;
+  auto rank = local_deadline.time_since_epoch().count();
+  rank -= deadline_slack_.load();
+  this->SubmitScheduled(std::move(package.first), rank, local_deadline);
+  return std::move(package.second);
+}
+
+inline void ThreadPool::CountEnqueue() {
+  auto depth = enqueued_.fetch_add(1, std::memory_order_relaxed) + 1 -
+               started_.load(std::memory_order_relaxed) -
+               dropped_.load(std::memory_order_relaxed);
+  auto peak = peak_depth_.load(std::memory_order_relaxed);
+  while (depth > peak && !peak_depth_.compare_exchange_weak(
+                             peak, depth, std::memory_order_relaxed)) {}
+}
+
+inline void ThreadPool::Submit(Task task) {
+  this->CountEnqueue();
+  PendingTask pending;
+  pending.function = std::move(task);
+  pending.enqueue_time = Clock::now();
+  if (mode_ == Mode::kShared) {
+    pending.rank = pending.enqueue_time.time_since_epoch().count();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      pending.sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+      tasks_.push_back(std::move(pending));
+    }
+    condition_.notify_one();
+    return;
+  }
+
+  const auto& context = CurrentWorker();
+  size_t target = 0;
+  if (context.pool == this) {
+    target = context.index;
+  } else {
+    target = next_queue_.fetch_add(1, std::memory_order_relaxed);
+    target %= queues_.size();
+  }
   {
+    std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+    queues_[target]->tasks.push_back(std::move(pending));
+  }
+  this->WakeWorkStealing();
+}
+
+inline void ThreadPool::SubmitScheduled(Task task, int64_t rank,
+                                        Clock::time_point deadline) {
+  this->CountEnqueue();
+  PendingTask pending;
+  pending.function = std::move(task);
+  pending.enqueue_time = Clock::now();
+  pending.rank = rank;
+  pending.deadline = deadline;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending.sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+    scheduled_.push_back(std::move(pending));
+    std::push_heap(scheduled_.begin(), scheduled_.end(), RankGreater());
+    num_scheduled_.fetch_add(1);
+  }
+  if (mode_ == Mode::kShared) {
+    condition_.notify_one();
+  } else {
+    this->WakeWorkStealing();
+  }
+}
+
+inline void ThreadPool::WakeWorkStealing() {
+  // 先增加pending_再检查sleepers_, 与worker中的顺序相反, 保证不会漏掉唤醒
+  pending_.fetch_add(1);
+  if (sleepers_.load() > 0) {
+    // 加锁保证worker要么还没开始检查条件, 要么已经进入wait
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    condition_.notify_one();
+  }
+}
+
+// 调用时必须持有mutex_. 取出rank最小的任务: 普通任务队列的队首和堆顶中
+// 较小的那个, 堆顶的rank大于max_rank时不取. 开启drop_expired时顺便丢弃
+// 已经超时的任务.
+inline bool ThreadPool::PopScheduled(PendingTask& task, int64_t max_rank) {
+  while (!tasks_.empty() || !scheduled_.empty()) {
+    if (scheduled_.empty() ||
+        (!tasks_.empty() && !RankGreater()(tasks_.front(), scheduled_[0]))) {
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+      return true;
+    }
+    if (scheduled_[0].rank > max_rank) { return false; }
+    std::pop_heap(scheduled_.begin(), scheduled_.end(), RankGreater());
+    task = std::move(scheduled_.back());
+    scheduled_.pop_back();
+    num_scheduled_.fetch_sub(1);
+    if (drop_expired_.load() && task.deadline < Clock::now()) {
+      // 销毁InlineTask连同其中捕获的std::promise, promise没有设置过值,
+      // 对应的future会收到broken_promise
+      task.function = nullptr;
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      if (mode_ == Mode::kWorkStealing) { pending_.fetch_sub(1); }
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+inline void ThreadPool::RunShared(int index) {
+  while (true) {
     std::unique_lock<std::mutex> lock(mutex_);
-    tasks_.emplace([task]() { (*task)(); });
+    condition_.wait(lock, [this] {
+      return stop_ || !tasks_.empty() || !scheduled_.empty();
+    });  // NOFORMAT(-2:)
+    PendingTask task;
+    if (!this->PopScheduled(task, std::numeric_limits<int64_t>::max())) {
+      if (stop_) { return; }
+      continue;
+    }
+    // task运行耗时较长, 所以这里得先unlock
+    lock.unlock();
+    this->RunTask(index, task);
+  }
+}
+
+inline void ThreadPool::RunWorkStealing(int index) {
+  CurrentWorker() = WorkerContext{this, index};
+  PendingTask task;
+  while (true) {
+    if (this->TakeTask(index, task)) {
+      this->RunTask(index, task);
+      task.function = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleepers_.fetch_add(1);
+    condition_.wait(lock, [this] { return stop_ || pending_.load() > 0; });
+    sleepers_.fetch_sub(1);
+    if (stop_ && pending_.load() == 0) { return; }
+  }
+}
+
+inline bool ThreadPool::TakeScheduled(PendingTask& task, int64_t max_rank) {
+  if (num_scheduled_.load(std::memory_order_relaxed) <= 0) { return false; }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!this->PopScheduled(task, max_rank)) { return false; }
+  pending_.fetch_sub(1);
+  return true;
+}
+
+// 依次尝试: 堆中已经到期的任务, 本地队列的尾部, 其他worker的队列头部,
+// 堆中剩余的任务
+inline bool ThreadPool::TakeTask(int index, PendingTask& task) {
+  auto now = Clock::now().time_since_epoch().count();
+  if (this->TakeScheduled(task, now)) { return true; }
+  auto& local = *queues_[index];
+  {
+    std::lock_guard<std::mutex> lock(local.mutex);
+    if (!local.tasks.empty()) {
+      task = std::move(local.tasks.back());
+      local.tasks.pop_back();
+      pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  const int num_queues = int(queues_.size());
+  for (int i = 1; i < num_queues; ++i) {
+    auto& victim = *queues_[(index + i) % num_queues];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  return this->TakeScheduled(task, std::numeric_limits<int64_t>::max());
+}
+
+inline void ThreadPool::RunTask(int index, PendingTask& task) {
+  started_.fetch_add(1, std::memory_order_relaxed);
+  auto start = Clock::now();
+  wait_time_.Record(start - task.enqueue_time);
+  task.function();
+  auto elapsed = Clock::now() - start;
+  run_time_.Record(elapsed);
+  auto& stats = worker_stats_[index];
+  stats.tasks.fetch_add(1, std::memory_order_relaxed);
+  stats.busy.fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+inline Json::Value ThreadPool::GetMetrics() {
+  std::lock_guard<std::mutex> lock(metrics_mutex_);
+  auto now = std::chrono::steady_clock::now();
+  auto interval = std::max<int64_t>(
+      std::chrono::nanoseconds(now - last_snapshot_).count(), 1);
+  auto enqueued = enqueued_.load(std::memory_order_relaxed);
+  auto started = started_.load(std::memory_order_relaxed);
+  auto dropped = dropped_.load(std::memory_order_relaxed);
+
+  Json::Value root;
+  root["num_threads"] = this->size();
+  root["mode"] = mode_ == Mode::kShared ? "shared" : "work_stealing";
+  root["enqueued"] = Json::Int64(enqueued);
+  root["enqueue_rate"] = double(enqueued - last_enqueued_) * 1e9 / interval;
+  auto depth = std::max<int64_t>(enqueued - started - dropped, 0);
+  root["queue_depth"] = Json::Int64(depth);
+  root["peak_queue_depth"] = Json::Int64(peak_depth_.load());
+  root["dropped"] = Json::Int64(dropped);
+  root["wait_time"] = wait_time_.ToJson();
+  root["run_time"] = run_time_.ToJson();
+  root["workers"] = Json::Value(Json::arrayValue);
+  for (int i = 0; i < this->size(); ++i) {
+    auto busy = worker_stats_[i].busy.load(std::memory_order_relaxed);
+    Json::Value worker;
+    worker["tasks"] = Json::Int64(worker_stats_[i].tasks.load());
+    worker["busy_ms"] = double(busy) / 1e6;
+    worker["utilization"] =
+        std::min(1.0, double(busy - last_busy_[i]) / double(interval));
+    if (!worker_cpus_[i].empty()) {
+      worker["cpus"] = FormatCpuList(worker_cpus_[i]);
+    }
+    root["workers"].append(worker);
+    last_busy_[i] = busy;
   }
-  condition_.notify_one();
-  return res;
+  last_snapshot_ = now;
+  last_enqueued_ = enqueued;
+  return root;
 }
 
 // the destructor joins all threads
@@ -66,4 +627,39 @@ inline ThreadPool::~ThreadPool() {
   for (std::thread& worker : workers_) { worker.join(); }
 }
 
+inline NumaThreadPool::NumaThreadPool(int threads_per_node,
+                                      ThreadPool::Mode mode,
+                                      const std::string& name,
+                                      const CpuTopology& topology)
+    : topology_(topology) {
+  CHECK(!topology_.nodes.empty()) << "no cpu is available.";
+  for (const auto& node : topology_.nodes) {
+    ThreadPoolOptions options;
+    options.name = name + std::to_string(node.id);
+    options.cpus = node.cpus;
+    options.pin_each = false;
+    int num_threads = threads_per_node;
+    if (num_threads <= 0) { num_threads = int(node.cpus.size()); }
+    pools_.emplace_back(new ThreadPool(num_threads, mode, options));
+  }
+}
+
+inline ThreadPool& NumaThreadPool::local() {
+  int index = topology_.NodeIndexOf(GetCurrentCpu());
+  return *pools_[std::max(index, 0)];
+}
+
+inline Json::Value NumaThreadPool::GetMetrics() {
+  Json::Value root;
+  root["nodes"] = Json::Value(Json::arrayValue);
+  for (int i = 0; i < this->size(); ++i) {
+    Json::Value node;
+    node["node"] = topology_.nodes[i].id;
+    node["cpus"] = FormatCpuList(topology_.nodes[i].cpus);
+    node["pool"] = pools_[i]->GetMetrics();
+    root["nodes"].append(node);
+  }
+  return root;
+}
+
 #endif  // PUBLIC_THREAD_POOL_H_
@@ -6,31 +6,133 @@
 
 #include "common.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+class LatencyHistogram;
+
+//////////////////////////////// class TscClock ////////////////////////////////
+
+// 基于rdtsc的时钟, 满足std::chrono中Clock的要求, 单位为纳秒.
+// 第一次调用now()时用steady_clock校准tsc的频率(约10ms), 之后每次调用只需要
+// 一次rdtsc和一次定点乘法, 开销在几十个cycle左右.
+// 只有cpu支持invariant tsc(频率恒定, 各核同步)时才使用rdtsc,
+// 否则退化为steady_clock.
+class TscClock {
+ public:
+  using rep = int64_t;
+  using period = std::nano;
+  using duration = std::chrono::nanoseconds;
+  using time_point = std::chrono::time_point<TscClock>;
+  static constexpr bool is_steady = true;
+
+  static time_point now() noexcept {
+    const auto& calibration = GetCalibration();
+    if (!calibration.available) {
+      auto now = std::chrono::steady_clock::now().time_since_epoch();
+      return time_point(std::chrono::duration_cast<duration>(now));
+    }
+    // 按有符号数计算: 其他核的tsc可能比校准时的读数略小(跨socket的偏差),
+    // 这时外推为校准之前的时间, 而不是回绕成一个很远的未来
+    auto ticks = int64_t(ReadTsc() - calibration.base_ticks);
+    auto nanoseconds = int64_t((__int128) ticks * calibration.mult >> kShift);
+    return time_point(duration(calibration.base_nanoseconds + nanoseconds));
+  }
+  // 当前是否真正在使用tsc
+  static bool is_available() { return GetCalibration().available; }
+
+ private:
+  static constexpr int kShift = 32;
+
+  // ns = base_nanoseconds + (ticks - base_ticks) * mult >> kShift
+  struct Calibration {
+    bool available = false;
+    uint64_t base_ticks = 0;
+    int64_t base_nanoseconds = 0;
+    uint64_t mult = 0;
+  };
+
+  static uint64_t ReadTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+  }
+  static bool HasInvariantTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0) { return false; }
+    if (eax < 0x80000007) { return false; }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1U << 8)) != 0;
+#else
+    return false;
+#endif
+  }
+  static Calibration Calibrate() {
+    using std::chrono::nanoseconds;
+    using std::chrono::steady_clock;
+    Calibration calibration;
+    if (!HasInvariantTsc()) { return calibration; }
+    auto start = steady_clock::now();
+    auto start_ticks = ReadTsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto stop = steady_clock::now();
+    auto stop_ticks = ReadTsc();
+    auto elapsed = std::chrono::duration_cast<nanoseconds>(stop - start);
+    if (stop_ticks <= start_ticks || elapsed.count() <= 0) {
+      return calibration;
+    }
+    auto ticks = double(stop_ticks - start_ticks);
+    auto ns_per_tick = double(elapsed.count()) / ticks;
+    calibration.available = true;
+    calibration.base_ticks = stop_ticks;
+    calibration.base_nanoseconds =
+        std::chrono::duration_cast<nanoseconds>(stop.time_since_epoch())
+            .count();
+    calibration.mult = uint64_t(ns_per_tick * double(1ULL << kShift));
+    return calibration;
+  }
+  static const Calibration& GetCalibration() {
+    static const Calibration calibration = Calibrate();
+    return calibration;
+  }
+};
+
 ///////////////////////////////// class Timer //////////////////////////////////
 
-class Timer {
+// 计时器, 通过Clock选择时钟:
+//   Timer: std::chrono::steady_clock, 单调递增, 不受NTP调整系统时间的影响.
+//   TscTimer: TscClock, 开销最小, 适合对亚微秒级的热点路径计时.
+template <class Clock> class BasicTimer {
  public:
+  // 兼容旧代码. 计时已经改用Clock(默认为steady_clock), 不再是system_clock
   using SystemClock = std::chrono::system_clock;
+  using Duration = typename Clock::duration;
+  using TimePoint = typename Clock::time_point;
   using SecondType = std::chrono::duration<float>;
   using MilliSecondType = std::chrono::duration<float, std::milli>;
   using MicroSecondType = std::chrono::duration<float, std::micro>;
-  PLAIN_OLD_DATA_CLASS(Timer);
+  PLAIN_OLD_DATA_CLASS(BasicTimer);
 
   void Start(bool check_status = true) {
     CHECK(!check_status || !is_running_) << "Timer is already started.";
-    start_ = SystemClock::now();
+    start_ = Clock::now();
     is_running_ = true;
   }
   void Stop(bool check_status = true) {
     CHECK(!check_status || is_running_) << "Timer is not started yet.";
-    stop_ = SystemClock::now();
+    stop_ = Clock::now();
     is_running_ = false;
     has_run_once_ = true;
     has_accumulated_ = false;
   }
-  SystemClock::duration Elapsed() {
+  Duration Elapsed() {
     CHECK(is_running_) << "Timer is not started yet.";
-    return SystemClock::now() - start_;
+    return Clock::now() - start_;
   }
 
   float Seconds() {
@@ -89,8 +191,10 @@ class Timer {
     count_ += 1;
     has_accumulated_ = true;
   }
+  // 同上, 并把这一次的耗时记录到histogram中
+  void Accumulate(LatencyHistogram& histogram);
   void ResetAccumulator() {
-    total_ = SystemClock::duration::zero();
+    total_ = Duration::zero();
     count_ = 0;
     has_accumulated_ = false;
   }
@@ -99,32 +203,224 @@ class Timer {
   bool has_run_once() const { return has_run_once_; }
 
  private:
-  SystemClock::time_point start_{SystemClock::now()};
-  SystemClock::time_point stop_{SystemClock::now()};
-  SystemClock::duration total_{SystemClock::duration::zero()};
+  TimePoint start_{Clock::now()};
+  TimePoint stop_{Clock::now()};
+  Duration total_{Duration::zero()};
   bool is_running_ = false;
   bool has_run_once_ = false;
   bool has_accumulated_ = false;
   int count_ = 0;
 };
 
+using Timer = BasicTimer<std::chrono::steady_clock>;
+using TscTimer = BasicTimer<TscClock>;
+
+//////////////////////////// class LatencyHistogram ////////////////////////////
+
+// 延迟分布直方图, 用于统计平均值掩盖掉的长尾延迟. 数值单位为纳秒.
+//
+// 桶按照对数-线性划分(与HdrHistogram相同): 小于32的值每个值一个桶,
+// 之后每个2的幂区间等分成32个桶, 相对误差不超过1/32. 超过2^40纳秒
+// (约18分钟)的值计入最后一个桶.
+//
+// Record是wait-free的: 每个线程固定写入一个分片, 只做relaxed的原子加法.
+// 线程数超过分片数时, 多个线程共用一个分片, 仍然正确, 只是会有cache争用.
+// 读取函数汇总所有分片, 与并发的Record同时进行时得到的是近似的快照.
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr int kSubBucketCount = 1 << kSubBucketBits;
+  static constexpr int kMaxBits = 40;
+  static constexpr int kNumBuckets =
+      kSubBucketCount * (kMaxBits - kSubBucketBits + 1);
+  static constexpr int kNumShards = 16;
+
+  LatencyHistogram() : shards_(new Shard[kNumShards]()) {}
+  DISABLE_COPY_ASIGN(LatencyHistogram);
+  DISABLE_MOVE_ASIGN(LatencyHistogram);
+  ~LatencyHistogram() = default;
+
+  void Record(int64_t nanoseconds) {
+    nanoseconds = std::max<int64_t>(nanoseconds, 0);
+    auto& shard = shards_[CurrentShard()];
+    shard.counts[BucketIndex(nanoseconds)].fetch_add(
+        1, std::memory_order_relaxed);
+    shard.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+  }
+  template <class Rep, class Period>
+  void Record(std::chrono::duration<Rep, Period> duration) {
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    this->Record(int64_t(duration_cast<nanoseconds>(duration).count()));
+  }
+
+  // p的取值范围是[0, 100], 返回该分位所在的桶的上界, 没有数据时返回-1
+  int64_t Percentile(double p) const { return this->Collect().Percentile(p); }
+  int64_t count() const { return this->Collect().total; }
+  // 没有数据时返回-1
+  double Mean() const { return this->Collect().Mean(); }
+
+  // 把other中的数据累加到当前直方图
+  void Merge(const LatencyHistogram& other) {
+    auto snapshot = other.Collect();
+    auto& shard = shards_[CurrentShard()];
+    for (int i = 0; i < kNumBuckets; ++i) {
+      if (snapshot.counts[i] == 0) { continue; }
+      shard.counts[i].fetch_add(snapshot.counts[i], std::memory_order_relaxed);
+    }
+    shard.sum.fetch_add(snapshot.sum, std::memory_order_relaxed);
+  }
+  // 与Record同时进行时, 同时写入的数据可能部分丢失
+  void Reset() {
+    for (int i = 0; i < kNumShards; ++i) {
+      for (auto& count : shards_[i].counts) {
+        count.store(0, std::memory_order_relaxed);
+      }
+      shards_[i].sum.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // 输出count, 平均值以及常用分位数, 时间单位为微秒.
+  // 所有字段来自同一次汇总, 与Record并发时也不会出现count与分位数不一致.
+  Json::Value ToJson() const {
+    auto snapshot = this->Collect();
+    Json::Value root;
+    root["count"] = Json::Int64(snapshot.total);
+    root["mean_us"] = snapshot.Mean() / 1000.0;
+    const std::vector<std::pair<std::string, double>> percentiles = {
+        {"min_us", 0.0},
+        {"p50_us", 50.0},
+        {"p90_us", 90.0},
+        {"p99_us", 99.0},
+        {"p999_us", 99.9},
+        {"max_us", 100.0},
+    };
+    for (const auto& pair : percentiles) {
+      root[pair.first] = double(snapshot.Percentile(pair.second)) / 1000.0;
+    }
+    return root;
+  }
+
+  static int BucketIndex(int64_t value) {
+    if (value < kSubBucketCount) { return int(value); }
+    int exponent = 63 - __builtin_clzll(uint64_t(value));
+    if (exponent >= kMaxBits) { return kNumBuckets - 1; }
+    int shift = exponent - kSubBucketBits;
+    int sub = int(value >> shift) - kSubBucketCount;
+    return kSubBucketCount * (shift + 1) + sub;
+  }
+  static int64_t BucketUpperBound(int index) {
+    if (index < kSubBucketCount) { return index; }
+    int shift = index / kSubBucketCount - 1;
+    int64_t sub = index % kSubBucketCount + kSubBucketCount;
+    return ((sub + 1) << shift) - 1;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<int64_t> counts[kNumBuckets];
+    std::atomic<int64_t> sum;
+  };
+
+  // 每个线程第一次调用时按顺序分配一个分片
+  static int CurrentShard() {
+    static std::atomic<int> next_shard{0};
+    thread_local int shard = next_shard.fetch_add(1) % kNumShards;
+    return shard;
+  }
+  // 某一时刻所有分片的汇总
+  struct Snapshot {
+    std::vector<int64_t> counts;
+    int64_t total = 0;
+    int64_t sum = 0;
+
+    int64_t Percentile(double p) const {
+      if (total <= 0) { return -1; }
+      p = std::min(std::max(p, 0.0), 100.0);
+      auto rank = std::max<int64_t>(1, int64_t(std::ceil(p / 100.0 * total)));
+      int64_t seen = 0;
+      for (int i = 0; i < kNumBuckets; ++i) {
+        seen += counts[i];
+        if (seen >= rank) { return BucketUpperBound(i); }
+      }
+      return BucketUpperBound(kNumBuckets - 1);
+    }
+    double Mean() const {
+      return total <= 0 ? -1.0 : double(sum) / double(total);
+    }
+  };
+
+  Snapshot Collect() const {
+    Snapshot snapshot;
+    snapshot.counts.assign(kNumBuckets, 0);
+    for (int i = 0; i < kNumShards; ++i) {
+      for (int k = 0; k < kNumBuckets; ++k) {
+        auto count = shards_[i].counts[k].load(std::memory_order_relaxed);
+        snapshot.counts[k] += count;
+        snapshot.total += count;
+      }
+      snapshot.sum += shards_[i].sum.load(std::memory_order_relaxed);
+    }
+    return snapshot;
+  }
+
+  std::unique_ptr<Shard[]> shards_;
+};
+
+template <class Clock>
+void BasicTimer<Clock>::Accumulate(LatencyHistogram& histogram) {
+  this->Accumulate();
+  histogram.Record(stop_ - start_);
+}
+
+/////////////////////////// class ScopedLatencyTimer ///////////////////////////
+
+// 在作用域结束时把耗时记录到histogram中:
+//   {
+//     ScopedLatencyTimer timer(histogram);
+//     DoSomething();
+//   }
+template <class Clock> class BasicScopedLatencyTimer {
+ public:
+  explicit BasicScopedLatencyTimer(LatencyHistogram& histogram)
+      : histogram_(histogram) {
+    timer_.Start();
+  }
+  DISABLE_COPY_ASIGN(BasicScopedLatencyTimer);
+  DISABLE_MOVE_ASIGN(BasicScopedLatencyTimer);
+  ~BasicScopedLatencyTimer() {
+    timer_.Stop();
+    timer_.Accumulate(histogram_);
+  }
+
+ private:
+  LatencyHistogram& histogram_;
+  BasicTimer<Clock> timer_;
+};
+
+using ScopedLatencyTimer = BasicScopedLatencyTimer<std::chrono::steady_clock>;
+using ScopedTscLatencyTimer = BasicScopedLatencyTimer<TscClock>;
+
 //////////////////////////// class FrequencyCounter ////////////////////////////
 
-class FrequencyCounter {
+// 单线程使用的简单计数器, 需要在线程之间共享或者需要多个窗口时使用RateMeter
+
+template <class Clock> class BasicFrequencyCounter {
  public:
+  // 兼容旧代码. 计时已经改用Clock(默认为steady_clock), 不再是system_clock
   using SystemClock = std::chrono::system_clock;
-  using Duration = SystemClock::duration;
-  using TimePoint = SystemClock::time_point;
-  PLAIN_OLD_DATA_CLASS(FrequencyCounter);
-  explicit FrequencyCounter(Duration interval) : interval_(interval) {}
+  using Duration = typename Clock::duration;
+  using TimePoint = typename Clock::time_point;
+  PLAIN_OLD_DATA_CLASS(BasicFrequencyCounter);
+  explicit BasicFrequencyCounter(Duration interval) : interval_(interval) {}
 
   void Reset() {
     count_ = 0;
-    stamp_ = SystemClock::now();
+    stamp_ = Clock::now();
   }
   float Accumulate(int times = 1, float default_value = -1.0F) {
     count_ += times;
-    auto elapsed = SystemClock::now() - stamp_;
+    auto elapsed = Clock::now() - stamp_;
     if (elapsed < interval_) { return default_value; }
     auto result = float(interval_.count()) / float(elapsed.count()) * count_;
     this->Reset();
@@ -133,39 +429,197 @@ class FrequencyCounter {
 
  private:
   Duration interval_{std::chrono::seconds(1)};
-  TimePoint stamp_{std::chrono::system_clock::now()};
+  TimePoint stamp_{Clock::now()};
   int count_{0};
 };
 
+using FrequencyCounter = BasicFrequencyCounter<std::chrono::steady_clock>;
+
+/////////////////////////////// class RateMeter ////////////////////////////////
+
+// 线程安全的速率统计, 单位为次/秒, 可以在多个worker之间共享.
+//
+// Mark是wait-free的: 每个线程固定写入一个独占cache line的分片, 只做一次
+// relaxed的原子加法, 不读时钟. 读取函数(Rate, ToJson等)把各分片新增的计数
+// 取走并折算进各个窗口, 只在读者之间加锁, 不会阻塞Mark.
+//
+// 窗口:
+//   kLastInterval: 最近一次折算的区间内的平均速率. 区间从上一次折算到这一次
+//     读取, 至少1秒, 长度取决于读取的频率, 不是固定的1秒窗口.
+//   k1Minute/k5Minutes/k15Minutes: 时间常数为1/5/15分钟的指数加权平均,
+//     与uptime的load average相同, 按实际经过的时间衰减, 读取的间隔不均匀
+//     也没有关系. 读取间隔越短, 曲线越平滑.
+//
+//   RateMeter meter;
+//   pool.post([&meter] { ...; meter.Mark(); });
+//   LOG(INFO) << DumpJsonValue(meter.ToJson());
+template <class Clock> class BasicRateMeter {
+ public:
+  using Duration = typename Clock::duration;
+  using TimePoint = typename Clock::time_point;
+  enum Window { kLastInterval, k1Minute, k5Minutes, k15Minutes, kNumWindows };
+  static constexpr int kNumShards = 16;
+
+  BasicRateMeter() : shards_(new Shard[kNumShards]()) {}
+  DISABLE_COPY_ASIGN(BasicRateMeter);
+  DISABLE_MOVE_ASIGN(BasicRateMeter);
+  ~BasicRateMeter() = default;
+
+  void Mark(int64_t n = 1) {
+    shards_[CurrentShard()].count.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  // 没有经过一个完整的折算区间时返回0
+  double Rate(Window window) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    this->Tick();
+    return rates_[window];
+  }
+  // 从构造或者Reset到现在的平均速率
+  double MeanRate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    this->Tick();
+    return this->GetMeanRate();
+  }
+  // 总次数, 包括还没有折算的部分
+  int64_t count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return total_ + this->PendingCount();
+  }
+
+  // 与Mark同时进行时, 同时写入的计数可能被算进重置之后
+  void Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    this->Collect();
+    start_ = last_tick_ = Clock::now();
+    total_ = 0;
+    initialized_ = false;
+    std::fill(std::begin(rates_), std::end(rates_), 0.0);
+  }
+
+  // 一次加锁得到所有窗口的一致快照
+  Json::Value ToJson() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    this->Tick();
+    Json::Value root;
+    root["count"] = Json::Int64(total_);
+    root["mean_rate"] = this->GetMeanRate();
+    const char* names[kNumWindows] = {"rate_last", "rate_1m", "rate_5m",
+                                      "rate_15m"};
+    for (int i = 0; i < kNumWindows; ++i) { root[names[i]] = rates_[i]; }
+    return root;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<int64_t> count;
+  };
+
+  static int CurrentShard() {
+    static std::atomic<int> next_shard{0};
+    thread_local int shard = next_shard.fetch_add(1) % kNumShards;
+    return shard;
+  }
+
+  int64_t PendingCount() const {
+    int64_t count = 0;
+    for (int i = 0; i < kNumShards; ++i) {
+      count += shards_[i].count.load(std::memory_order_relaxed);
+    }
+    return count;
+  }
+  // 取走所有分片的计数
+  int64_t Collect() const {
+    int64_t count = 0;
+    for (int i = 0; i < kNumShards; ++i) {
+      count += shards_[i].count.exchange(0, std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+  // 距上次折算超过1秒时, 把这段时间的计数按平均速率折算进各个窗口.
+  // 时间常数为T的窗口经过dt之后: rate += (1 - e^(-dt/T)) * (新速率 - rate)
+  void Tick() const {
+    using Seconds = std::chrono::duration<double>;
+    auto now = Clock::now();
+    double elapsed = Seconds(now - last_tick_).count();
+    if (elapsed < 1.0) { return; }
+    int64_t count = this->Collect();
+    total_ += count;
+    last_tick_ = now;
+    double rate = double(count) / elapsed;
+    rates_[kLastInterval] = rate;
+    const double constants[kNumWindows] = {1.0, 60.0, 300.0, 900.0};
+    for (int i = k1Minute; i < kNumWindows; ++i) {
+      double alpha = initialized_ ? 1.0 - std::exp(-elapsed / constants[i])
+                                  : 1.0;
+      rates_[i] += alpha * (rate - rates_[i]);
+    }
+    initialized_ = true;
+  }
+  double GetMeanRate() const {
+    using Seconds = std::chrono::duration<double>;
+    double elapsed = Seconds(last_tick_ - start_).count();
+    return elapsed > 0.0 ? double(total_) / elapsed : 0.0;
+  }
+
+  std::unique_ptr<Shard[]> shards_;
+  mutable std::mutex mutex_;  // 保护下面的成员, 只在读者之间竞争
+  mutable TimePoint start_{Clock::now()};
+  mutable TimePoint last_tick_{start_};
+  mutable int64_t total_ = 0;
+  mutable bool initialized_ = false;
+  mutable double rates_[kNumWindows] = {};
+};
+
+using RateMeter = BasicRateMeter<std::chrono::steady_clock>;
+
 //////////////////////////////// class DateTime ////////////////////////////////
 
+// DateTime表示的是日历时间, 所以仍然使用system_clock.
+// 与本地时间的转换走快速路径: 每个线程缓存当前时区的偏移量和它的有效区间,
+// 超出区间(比如跨过夏令时的切换点)时才重新查询时区; 格式化和解析都是手写的,
+// 不经过stringstream, 同一天/同一秒内的值直接复用上一次的日期/时间部分.
 class DateTime {
  public:
   using SystemClock = std::chrono::system_clock;
   using TimePoint = SystemClock::time_point;
   using Duration = SystemClock::duration;
 
+  // 秒的小数部分的位数, 与Duration的精度一致, 纳秒为9
+  static constexpr int kFractionDigits = [] {
+    int digits = 0;
+    for (auto den = Duration::period::den; den > 1; den /= 10) { ++digits; }
+    return digits;
+  }();
+  // string()的长度
+  static constexpr size_t kStringSize =
+      19 + (kFractionDigits > 0 ? 1 + kFractionDigits : 0);
+
   PLAIN_OLD_DATA_CLASS(DateTime);
   explicit DateTime(TimePoint t) : value(t) {}
   explicit DateTime(Duration d) : value(TimePoint(d)) {}
-  explicit DateTime(const std::string& content) {
-    date::local_time<Duration> local_time;
-    std::stringstream ss(content);
-    date::from_stream(ss, "%Y-%m-%d %H:%M:%S", local_time);
-    // 时区的剥离与添加实际上是time_zone做的
-    value = date::current_zone()->to_sys(local_time);
-  }
+  // 按本地时间解析"%Y-%m-%d %H:%M:%S", 不是固定宽度的格式时交给date库
+  explicit DateTime(const std::string& content);
 
   // 输出: 2021-08-02 23:15:34.132548068
   // 0~23: 2021-08-02 23:15:34.132
   // 0~19: 2021-08-02 23:15:34
   // 0~10: 2021-08-02
-  std::string string() const {
-    std::stringstream ss;
-    auto zoned = date::make_zoned(date::current_zone(), value);
-    date::to_stream(ss, "%Y-%m-%d %H:%M:%S", zoned);
-    return ss.str();
-  }
+  std::string string() const;
+
+  // 同string(), 写入buffer(至少kStringSize字节, 不补'\0'), 返回写入的长度.
+  // 只支持0~9999年.
+  size_t Format(char* buffer) const;
+
+  // 批量格式化一列时间, 结果连续存放, 每个值后面跟一个separator,
+  // 所以第i个值从i * (kStringSize + 1)开始. 有序的时间戳复用效果最好.
+  static std::string FormatColumn(const std::vector<DateTime>& values,
+                                  char separator = '\n');
+
+  // 解析固定宽度的"YYYY-MM-DD HH:MM:SS", 秒后面可以带最多kFractionDigits位
+  // 小数, 不允许有其他字符. 失败返回false, 不修改result.
+  static bool Parse(std::string_view content, DateTime& result);
 
   // 这里展示floor的用法
   DateTime seconds() const {
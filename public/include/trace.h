@@ -0,0 +1,99 @@
+#ifndef PUBLIC_TRACE_H_
+#define PUBLIC_TRACE_H_
+
+#include "common.h"
+#include "timer.h"
+
+// 作用域级别的trace, 输出Chrome trace event格式的json, 可以直接用
+// chrome://tracing或者https://ui.perfetto.dev打开:
+//   Tracer::Instance().Start("/tmp/trace.json");
+//   ...
+//   void Foo() {
+//     TRACE_SCOPE("Foo");
+//     ...
+//   }
+//   ...
+//   Tracer::Instance().Stop();
+//
+// 每个作用域在结束时记录一个complete event(开始时间和持续时间), 写入当前
+// 线程自己的无锁环形缓冲区, 后台线程定期把缓冲区中的事件追加到文件中.
+// 缓冲区满时丢弃新的事件. 没有Start时, TRACE_SCOPE的开销只是读一个原子变量.
+// name只保存指针, 必须是字符串常量或者生命周期足够长的字符串.
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) \
+  TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+class Tracer {
+ public:
+  static Tracer& Instance();
+  DISABLE_COPY_ASIGN(Tracer);
+  DISABLE_MOVE_ASIGN(Tracer);
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // 开始记录, 每隔interval把新的事件追加到file中, file会被清空.
+  // 已经在记录或者file无法写入时返回false, 只打印错误, 不影响进程运行.
+  bool Start(const std::string& file,
+             std::chrono::milliseconds interval = std::chrono::seconds(1));
+  // 停止记录, 并把剩余的事件写入文件
+  void Stop();
+  // 立即把缓冲区中的事件写入文件
+  void Flush();
+  // 取出缓冲区中的所有事件, 不写文件. 返回Json数组, 每个元素是一个事件.
+  Json::Value Collect();
+  // 持有的线程缓冲区个数, 包括已经退出但事件还没有被取走的线程
+  int num_buffers();
+
+  // 记录一个事件, 时间单位为纳秒, 一般通过TRACE_SCOPE调用
+  void Record(const char* name, int64_t begin, int64_t duration);
+
+ private:
+  struct TraceEvent {
+    const char* name;
+    int64_t begin;
+    int64_t duration;
+  };
+  class TraceBuffer;
+
+  Tracer() = default;
+  ~Tracer();
+  TraceBuffer& CurrentBuffer();
+  void Run(std::chrono::milliseconds interval);
+
+  static std::atomic<bool> enabled_;
+
+  std::mutex mutex_;  // 保护buffers_
+  std::vector<std::shared_ptr<TraceBuffer>> buffers_;
+  std::mutex collect_mutex_;
+
+  std::mutex flush_mutex_;  // 保护以下成员
+  std::string file_;
+  std::thread flusher_;
+  std::condition_variable condition_;
+  bool running_ = false;
+};
+
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name) {
+    if (!Tracer::enabled()) { return; }
+    name_ = name;
+    begin_ = TscClock::now();
+  }
+  DISABLE_COPY_ASIGN(TraceScope);
+  DISABLE_MOVE_ASIGN(TraceScope);
+  ~TraceScope() {
+    if (name_ == nullptr) { return; }
+    auto begin = begin_.time_since_epoch().count();
+    auto duration = (TscClock::now() - begin_).count();
+    Tracer::Instance().Record(name_, begin, duration);
+  }
+
+ private:
+  const char* name_ = nullptr;
+  TscClock::time_point begin_;
+};
+
+#endif  // PUBLIC_TRACE_H_
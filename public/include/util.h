@@ -2,15 +2,43 @@
 #define PUBLIC_UTIL_H_
 
 #include "common.h"
+#include "directory.h"
+#include "disk_usage.h"
+#include "format.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
 
 // 如果需要的话, 生成文件所在的目录
 void MakeDirsForFile(const std::string& path);
 
 // 一次性读取文件所有的内容，如打开失败返回空字符串
+// 普通文件通过mmap读取, 只分配一次内存, 只拷贝一次
 std::string ReadFile(const std::string& file, bool is_binary = false);
 
+// 零拷贝版本, 直接返回映射的内容, 生命周期与file相同
+std::string_view ReadFile(const MappedFile& file);
+
 // 按行读取文件内容, 需要T重载运算符: operator>>
 template <class T> std::vector<T> ReadLines(const std::string& file);
+template <class T> std::vector<T> ReadLines(const MappedFile& file);
+
+// 按行切分映射的文件, 不拷贝内容, 不包含换行符, 生命周期与file相同
+std::vector<std::string_view> ReadLines(const MappedFile& file);
+
+// 并行版本: 在换行处把文件切成大约batch_bytes大小的块, 放到pool中并行解析,
+// 结果保持文件中的顺序. 整数和浮点数用std::from_chars解析, 不受locale影响,
+// 其他类型仍然使用operator>>. 与串行版本一样, 遇到无法解析的内容时停止.
+// 不要在pool的worker中调用, 否则可能因为等待自己所在的pool而死锁.
+template <class T>
+std::vector<T> ReadLines(const std::string& file, ThreadPool& pool,
+                         size_t batch_bytes = 4 << 20);
+
+// 流式版本: 按文件中的顺序每解析完一块就调用一次callback(std::vector<T>&),
+// 同时在解析的块数不超过pool大小的两倍, 内存占用与文件大小无关.
+// 文件打开失败时返回false.
+template <class T, class F>
+bool ReadLinesInBatches(const std::string& file, ThreadPool& pool, F callback,
+                        size_t batch_bytes = 4 << 20);
 
 // 一次性写入文件的所有内容
 bool WriteFile(const std::string& file, const char* data, int length);
@@ -29,29 +57,78 @@ Json::Value ReadJsonFile(const std::string& json_file);
 // 写json结构到文件，必要的时候生成必须的目录
 void WriteJsonFile(const Json::Value& root, const std::string& json_file);
 
-// 运行shell命令, 出错返回空字符串
+// 运行shell命令, 返回stdout, 出错返回空字符串. 与popen相同, 命令继承
+// 当前进程的stdin和stderr.
 std::string ExecShell(const std::string& cmd);
 
-// 返回目录中所有的文件和子目录, 结果做升序排列
+// 返回目录中所有的文件和子目录, 结果做升序排列.
+// 目录无法读取时抛出boost::filesystem::filesystem_error.
 std::vector<std::string> ListDirectory(
     const std::string& dirname, const std::regex& pattern = std::regex(".*"));
 
+// 同上, 用前缀/后缀/glob过滤, 比std::regex快得多. 需要文件类型时使用
+// ListEntries, 需要反复列出同一个目录时使用DirectoryIndex.
+std::vector<std::string> ListDirectory(const std::string& dirname,
+                                       const NameFilter& filter);
+
 // 计算字符串的md5值
 std::string CalcMD5(const std::string& content);
 
+// 增量计算md5, 适合数据分多次到达的场景:
+//   MD5Hasher hasher;
+//   hasher.Update(part1);
+//   hasher.Update(part2);
+//   std::string md5 = hasher.Finish();
+// Finish之后hasher被重置, 可以继续用来计算下一份数据.
+class MD5Hasher {
+ public:
+  MD5Hasher();
+  DISABLE_COPY_ASIGN(MD5Hasher);
+  DISABLE_MOVE_ASIGN(MD5Hasher);
+  ~MD5Hasher();
+
+  void Update(const void* data, size_t size);
+  void Update(std::string_view content) {
+    this->Update(content.data(), content.size());
+  }
+  // 返回32个字符的小写十六进制串
+  std::string Finish();
+
+ private:
+  struct evp_md_ctx_st* context_;
+};
+
+// 计算文件的md5值, 普通文件通过mmap读取, 其他文件分块读取,
+// 不会把整个文件读入内存. 打开失败返回空字符串.
+std::string CalcFileMD5(const std::string& file);
+
+// 在pool中并行计算多个文件的md5值, 结果与files一一对应.
+// 调用线程在等待时也参与计算, 可以在pool的worker中调用.
+std::vector<std::string> CalcFileMD5(const std::vector<std::string>& files,
+                                     ThreadPool& pool);
+
+// 将二进制数据转换成小写的十六进制字符串
+std::string GetHexString(const void* data, size_t size);
+
 // 返回path所在的磁盘的可用空间的大小, 无效路径返回-1.
 int64_t GetAvailableSpace(const std::string& path);
 
 // 返回path指定的文件或者目录的大小, 无效路径返回-1.
 // 只考虑普通文件和目录, 不包括链接等其他形式的文件
+// 需要反复统计同一个目录时, 可以使用带缓存的DiskUsage
 int64_t GetFileSize(const std::string& path);
 
+// 同上, 子目录在pool中并行扫描
+int64_t GetFileSize(const std::string& path, ThreadPool& pool);
+
 // 通过字符串计算字节数, 支持的单位包括: b, k{b}, m{b}, g{b}
 // 不区分大小写, 支持小数, 比如: "1.5k", "0.3G", "32 KB"
 int64_t GetBytesByString(std::string content);
 
 // 将bytes转换成利于人读的字符串
 std::string GetBytesString(int64_t bytes);
+// 同上, 结果追加到buffer
+void AppendBytesString(std::string& buffer, int64_t bytes);
 
 // 通过字符串计算秒数, 支持的单位包括: s{ec}, m{in}, h{our}, d{ay}
 // 不区分大小写, 支小持数, 比如: "1.5h", "0.3D", "24 hour"
@@ -59,9 +136,12 @@ int64_t GetSecondsByString(std::string content);
 
 // 将seconds转换成利于认读的字符串
 std::string GetSecondsString(int64_t seconds);
+// 同上, 结果追加到buffer
+void AppendSecondsString(std::string& buffer, int64_t seconds);
 
-// vector -> string, converter为: ToString(T)
-template <class T> std::string ToString(const std::vector<T>& values);
+// 数值, 字符串, 以及它们组成的vector/map/pair等任意嵌套的容器 -> string,
+// 格式见AppendString. 在热点路径上可以直接用AppendString复用buffer.
+template <class T> std::string ToString(const T& value);
 
 // vector -> string, 显式提供converter
 template <class T, class C>
@@ -78,37 +158,140 @@ template <class T> std::vector<T> ReadLines(const std::string& file) {
   return samples;
 }
 
-template <class T, class C>
-std::string ToString(const std::vector<T>& values, C converter) {
-  std::vector<std::string> string_values;
-  for (size_t i = 0; i < values.size(); ++i) {
-    string_values.push_back(converter(values[i]));
+namespace util_internal {
+
+// 直接在映射的内存上构造istream, 避免拷贝
+class MemoryStreamBuf : public std::streambuf {
+ public:
+  MemoryStreamBuf(const char* data, size_t size) {
+    char* begin = const_cast<char*>(data);
+    this->setg(begin, begin, begin + size);
   }
-  std::string result = boost::algorithm::join(string_values, ", ");
-  return std::string("[") + result + std::string("]");
-}
+};
 
-inline std::string ToString(char value) {
-  return (boost::format("%d") % int(value)).str();
+// 可以用std::from_chars解析的类型, char和bool的operator>>语义与数值不同
+template <class T>
+constexpr bool kFromChars =
+    std::is_floating_point<T>::value ||
+    (std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+     !std::is_same<T, char>::value && !std::is_same<T, signed char>::value &&
+     !std::is_same<T, unsigned char>::value);
+
+// 解析[begin, end)中以空白分隔的值并追加到values, 遇到无法解析的内容返回false
+template <class T>
+bool ParseValues(const char* begin, const char* end, std::vector<T>& values) {
+  if constexpr (kFromChars<T>) {
+    const char* ptr = begin;
+    while (true) {
+      while (ptr < end && std::isspace(static_cast<unsigned char>(*ptr))) {
+        ++ptr;
+      }
+      if (ptr == end) { return true; }
+      if (*ptr == '+') { ++ptr; }
+      T value;
+      auto result = std::from_chars(ptr, end, value);
+      if (result.ec != std::errc()) { return false; }
+      values.push_back(value);
+      ptr = result.ptr;
+    }
+  } else {
+    MemoryStreamBuf buffer(begin, end - begin);
+    std::istream infile(&buffer);
+    T value;
+    while (infile >> value) { values.push_back(value); }
+    return infile.eof();
+  }
 }
 
-inline std::string ToString(int value) {
-  return (boost::format("%d") % value).str();
+}  // namespace util_internal
+
+template <class T> std::vector<T> ReadLines(const MappedFile& file) {
+  if (!file.is_open()) { return std::vector<T>{}; }
+  util_internal::MemoryStreamBuf buffer(file.data(), file.size());
+  std::istream infile(&buffer);
+  std::vector<T> samples;
+  T sample;
+  while (infile >> sample) { samples.push_back(sample); }
+  return samples;
 }
 
-inline std::string ToString(float value) {
-  return (boost::format("%.2f") % value).str();
+template <class T, class F>
+bool ReadLinesInBatches(const std::string& file, ThreadPool& pool, F callback,
+                        size_t batch_bytes) {
+  MappedFile mapped(file, MappedFile::Advice::kSequential);
+  if (!mapped.is_open()) { return false; }
+  batch_bytes = std::max<size_t>(batch_bytes, 1);
+
+  // first: 该块是否完整解析, second: 解析结果
+  using Batch = std::pair<bool, std::vector<T>>;
+  std::deque<std::future<Batch>> pending;
+  auto content = mapped.view();
+  auto submit = [&content, &pending, &pool, batch_bytes] {
+    if (content.empty()) { return false; }
+    auto length = content.find('\n', std::min(batch_bytes, content.size()) - 1);
+    length = std::min(length, content.size() - 1) + 1;
+    auto chunk = content.substr(0, length);
+    content.remove_prefix(length);
+    pending.push_back(pool.enqueue([chunk] {
+      Batch batch;
+      auto end = chunk.data() + chunk.size();
+      batch.first = util_internal::ParseValues(chunk.data(), end, batch.second);
+      return batch;
+    }));
+    return true;
+  };
+
+  const size_t max_pending = std::max(2, pool.size() * 2);
+  bool failed = false;
+  try {
+    while (pending.size() < max_pending && submit()) {}
+    while (!pending.empty()) {
+      auto batch = pending.front().get();
+      pending.pop_front();
+      if (failed) { continue; }
+      if (!batch.second.empty()) { callback(batch.second); }
+      failed = !batch.first;
+      if (!failed) { submit(); }
+    }
+  } catch (...) {
+    // 解析任务引用着映射的内存, 必须等它们结束
+    for (auto& result : pending) { result.wait(); }
+    throw;
+  }
+  return true;
 }
 
-inline std::string ToString(double value) {
-  return (boost::format("%.2f") % value).str();
+template <class T>
+std::vector<T> ReadLines(const std::string& file, ThreadPool& pool,
+                         size_t batch_bytes) {
+  std::vector<T> samples;
+  auto append = [&samples](std::vector<T>& batch) {
+    if (samples.empty()) {
+      samples.swap(batch);
+    } else {
+      samples.insert(samples.end(), std::make_move_iterator(batch.begin()),
+                     std::make_move_iterator(batch.end()));
+    }
+  };
+  ReadLinesInBatches<T>(file, pool, append, batch_bytes);
+  return samples;
 }
 
-inline std::string ToString(const std::string& value) { return value; }
+template <class T, class C>
+std::string ToString(const std::vector<T>& values, C converter) {
+  std::string result = "[";
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (i > 0) { result.append(", "); }
+    result.append(converter(values[i]));
+  }
+  result.push_back(']');
+  return result;
+}
 
-template <class T> std::string ToString(const std::vector<T>& values) {
-  auto converter = [](const T& v) { return ToString(v); };
-  return ToString(values, converter);
+template <class T> std::string ToString(const T& value) {
+  std::string result;
+  AppendString(result, value);
+  return result;
 }
 
 #endif  // PUBLIC_UTIL_H_
@@ -0,0 +1,606 @@
+#include "async_file.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// 文件大小未知时(比如/proc下的文件)每次扩容的起始大小
+static const size_t kInitialChunk = 64 * 1024;
+// io_uring的一次读写最多处理的字节数, sqe中的长度只有32位
+static const size_t kMaxTransfer = 1 << 30;
+// 用于唤醒后台线程的nop请求的user_data
+static const uint64_t kWakeUp = 0;
+
+struct AsyncFileIO::Request {
+  enum class Op { kRead, kWrite };
+  enum class Stage { kOpen, kTransfer, kClose };
+
+  Op op = Op::kRead;
+  Stage stage = Stage::kOpen;
+  std::string file;
+  std::string content;
+  size_t offset = 0;
+  size_t expected = 0;  // 读取时为打开时的文件大小, 0表示未知
+  int fd = -1;
+  int error = 0;
+  ReadCallback read_callback;
+  WriteCallback write_callback;
+};
+
+class AsyncFileIO::Engine {
+ public:
+  explicit Engine(AsyncFileIO* owner) : owner_(owner) {}
+  DISABLE_COPY_ASIGN(Engine);
+  DISABLE_MOVE_ASIGN(Engine);
+  virtual ~Engine() = default;
+
+  virtual void Submit(const std::vector<Request*>& requests) = 0;
+
+ protected:
+  // 读到的数据已经写入content之后调用, 返回是否已经读完.
+  // 打开时知道文件大小的, 读满就结束, 省掉最后一次返回0的读取;
+  // 否则缓冲区满了就翻倍, 直到读到文件尾.
+  static bool AfterRead(Request& request, size_t bytes);
+
+  AsyncFileIO* owner_;
+};
+
+//////////////////////////////// io_uring ////////////////////////////////
+
+// 直接通过系统调用使用io_uring. 提交队列由mutex_保护, 完成队列只有后台
+// 线程访问. 每个请求同一时刻最多只有一个sqe在途, 在途请求数又不超过提交
+// 队列的长度, 所以提交队列和完成队列都不会溢出.
+class AsyncFileIO::UringEngine : public Engine {
+ public:
+  UringEngine(AsyncFileIO* owner, int queue_depth);
+  ~UringEngine() override;
+
+  // io_uring可用, 并且支持需要的所有操作
+  bool ok() const { return ring_fd_ >= 0; }
+  void Submit(const std::vector<Request*>& requests) override;
+
+ private:
+  bool Setup(int queue_depth);
+  bool Probe();
+  void Run();
+  // 处理一个完成事件, 返回请求是否已经结束
+  bool Advance(Request* request, int result);
+  // 以下三个函数调用时必须持有mutex_
+  io_uring_sqe* NextSqe(uint64_t user_data);
+  void Prepare(Request* request);
+  void StartWaiting();
+  // 把已经准备好的sqe提交给内核, 可以选择同时等待完成事件
+  void Flush(bool wait);
+
+  int ring_fd_ = -1;
+  void* sq_ring_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0;
+  void* cq_ring_ = MAP_FAILED;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+
+  std::mutex mutex_;
+  unsigned to_submit_ = 0;
+  int capacity_ = 0;
+  int in_flight_ = 0;
+  std::deque<Request*> waiting_;
+  bool stop_ = false;
+  std::thread reaper_;
+};
+
+static int IoUringSetup(unsigned entries, io_uring_params* params) {
+  return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                        unsigned flags) {
+  return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                     nullptr, 0));
+}
+
+static int IoUringRegister(int fd, unsigned opcode, void* arg,
+                           unsigned nr_args) {
+  return int(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+AsyncFileIO::UringEngine::UringEngine(AsyncFileIO* owner, int queue_depth)
+    : Engine(owner) {
+  if (!this->Setup(queue_depth) || !this->Probe()) {
+    if (ring_fd_ >= 0) { ::close(ring_fd_); }
+    ring_fd_ = -1;
+    return;
+  }
+  reaper_ = std::thread([this] { this->Run(); });
+}
+
+AsyncFileIO::UringEngine::~UringEngine() {
+  if (reaper_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      NextSqe(kWakeUp)->opcode = IORING_OP_NOP;
+    }
+    this->Flush(false);
+    reaper_.join();
+  }
+  if (sqes_ != nullptr) { munmap(sqes_, sqes_size_); }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) { munmap(sq_ring_, sq_ring_size_); }
+  if (ring_fd_ >= 0) { ::close(ring_fd_); }
+}
+
+bool AsyncFileIO::UringEngine::Setup(int queue_depth) {
+  io_uring_params params = {};
+  ring_fd_ = IoUringSetup(std::max(queue_depth, 1), &params);
+  if (ring_fd_ < 0) { return false; }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) { return false; }
+  cq_ring_ = single_mmap ? sq_ring_
+                         : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                IORING_OFF_CQ_RING);
+  if (cq_ring_ == MAP_FAILED) { return false; }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) { return false; }
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  auto* sq = static_cast<char*>(sq_ring_);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  auto* cq = static_cast<char*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  capacity_ = int(params.sq_entries);
+  return true;
+}
+
+// openat/read/write/close都是5.6内核才加入的
+bool AsyncFileIO::UringEngine::Probe() {
+  const unsigned num_ops = 256;
+  std::vector<char> buffer(sizeof(io_uring_probe) +
+                           num_ops * sizeof(io_uring_probe_op));
+  auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+  if (IoUringRegister(ring_fd_, IORING_REGISTER_PROBE, probe, num_ops) < 0) {
+    return false;
+  }
+  for (int op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE,
+                 IORING_OP_CLOSE}) {
+    if (op > probe->last_op ||
+        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AsyncFileIO::UringEngine::Submit(const std::vector<Request*>& requests) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto* request : requests) {
+      if (in_flight_ < capacity_) {
+        ++in_flight_;
+        this->Prepare(request);
+      } else {
+        waiting_.push_back(request);
+      }
+    }
+  }
+  this->Flush(false);
+}
+
+// 返回的sqe要等到Flush时才对内核可见, 所以可以在返回之后再填写
+io_uring_sqe* AsyncFileIO::UringEngine::NextSqe(uint64_t user_data) {
+  unsigned index = (*sq_tail_ + to_submit_) & *sq_mask_;
+  io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = user_data;
+  sq_array_[index] = index;
+  ++to_submit_;
+  return sqe;
+}
+
+void AsyncFileIO::UringEngine::Prepare(Request* request) {
+  auto* sqe = this->NextSqe(reinterpret_cast<uint64_t>(request));
+  switch (request->stage) {
+    case Request::Stage::kOpen:
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = reinterpret_cast<uint64_t>(request->file.c_str());
+      if (request->op == Request::Op::kRead) {
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+      } else {
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        sqe->len = 0644;
+      }
+      break;
+    case Request::Stage::kTransfer: {
+      auto length = std::min(request->content.size() - request->offset,
+                             kMaxTransfer);
+      sqe->opcode = request->op == Request::Op::kRead ? IORING_OP_READ
+                                                      : IORING_OP_WRITE;
+      sqe->fd = request->fd;
+      sqe->addr = reinterpret_cast<uint64_t>(&request->content[0] +
+                                             request->offset);
+      sqe->len = unsigned(length);
+      sqe->off = request->offset;
+      break;
+    }
+    case Request::Stage::kClose:
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = request->fd;
+      break;
+  }
+}
+
+void AsyncFileIO::UringEngine::StartWaiting() {
+  while (!waiting_.empty() && in_flight_ < capacity_) {
+    ++in_flight_;
+    this->Prepare(waiting_.front());
+    waiting_.pop_front();
+  }
+}
+
+void AsyncFileIO::UringEngine::Flush(bool wait) {
+  unsigned to_submit = 0;
+  {
+    // 只有持有mutex_的线程会修改tail, 内核只读
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::swap(to_submit, to_submit_);
+    __atomic_store_n(sq_tail_, *sq_tail_ + to_submit, __ATOMIC_RELEASE);
+  }
+  // 多个线程可以同时提交, 每个线程提交自己准备的数量, 总数就是对的
+  while (to_submit > 0 || wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int submitted = IoUringEnter(ring_fd_, to_submit, wait ? 1 : 0, flags);
+    if (submitted < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) { continue; }
+      PLOG(FATAL) << "io_uring_enter() failed";
+    }
+    to_submit -= std::min(to_submit, unsigned(submitted));
+    wait = false;
+  }
+}
+
+bool AsyncFileIO::UringEngine::Advance(Request* request, int result) {
+  using Stage = Request::Stage;
+  switch (request->stage) {
+    case Stage::kOpen:
+      if (result < 0) {
+        request->error = -result;
+        return true;
+      }
+      request->fd = result;
+      request->stage = Stage::kTransfer;
+      if (request->op == Request::Op::kRead) {
+        struct stat st = {};
+        if (fstat(request->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+          request->expected = size_t(st.st_size);
+        }
+        request->content.resize(request->expected > 0 ? request->expected
+                                                      : kInitialChunk);
+      } else if (request->content.empty()) {
+        request->stage = Stage::kClose;
+      }
+      return false;
+    case Stage::kTransfer:
+      if (result == -EINTR || result == -EAGAIN) { return false; }
+      if (result < 0) {
+        request->error = -result;
+        request->stage = Stage::kClose;
+        return false;
+      }
+      if (request->op == Request::Op::kRead) {
+        if (AfterRead(*request, size_t(result))) {
+          request->stage = Stage::kClose;
+        }
+      } else {
+        request->offset += size_t(result);
+        if (result == 0) {
+          request->error = EIO;
+          request->stage = Stage::kClose;
+        } else if (request->offset >= request->content.size()) {
+          request->stage = Stage::kClose;
+        }
+      }
+      return false;
+    case Stage::kClose:
+      // 写入时close的错误意味着数据可能没有落盘, 读取时可以忽略
+      if (result < 0 && request->op == Request::Op::kWrite &&
+          request->error == 0) {
+        request->error = -result;
+      }
+      request->fd = -1;
+      return true;
+  }
+  return true;
+}
+
+void AsyncFileIO::UringEngine::Run() {
+  std::vector<std::pair<Request*, int>> events;
+  std::vector<Request*> finished;
+  while (true) {
+    this->Flush(true);
+    // 先把所有完成事件取出来, 尽快归还完成队列中的位置
+    bool wake_up = false;
+    events.clear();
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+      if (cqe.user_data == kWakeUp) {
+        wake_up = true;
+      } else {
+        events.emplace_back(reinterpret_cast<Request*>(cqe.user_data),
+                            cqe.res);
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    finished.clear();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& event : events) {
+        if (this->Advance(event.first, event.second)) {
+          finished.push_back(event.first);
+        } else {
+          this->Prepare(event.first);
+        }
+      }
+      in_flight_ -= int(finished.size());
+      this->StartWaiting();
+      if (wake_up && stop_ && in_flight_ == 0) { break; }
+    }
+    // 回调可能会提交新的请求, 所以不能持有mutex_
+    for (auto* request : finished) {
+      owner_->Complete(request, request->error == 0);
+    }
+  }
+}
+
+//////////////////////////////// posix ////////////////////////////////
+
+// io_uring不可用时的后备实现, 每个请求在线程池中同步执行
+class AsyncFileIO::PosixEngine : public Engine {
+ public:
+  PosixEngine(AsyncFileIO* owner, int num_threads)
+      : Engine(owner), pool_(std::max(num_threads, 1)) {}
+
+  void Submit(const std::vector<Request*>& requests) override {
+    for (auto* request : requests) {
+      pool_.post([this, request] {
+        this->Run(*request);
+        owner_->Complete(request, request->error == 0);
+      });  // NOFORMAT(-3:)
+    }
+  }
+
+ private:
+  static void Run(Request& request);
+
+  ThreadPool pool_;
+};
+
+void AsyncFileIO::PosixEngine::Run(Request& request) {
+  bool is_read = request.op == Request::Op::kRead;
+  int flags = is_read ? O_RDONLY | O_CLOEXEC
+                      : O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  int fd = ::open(request.file.c_str(), flags, 0644);
+  if (fd < 0) {
+    request.error = errno;
+    return;
+  }
+  if (is_read) {
+    struct stat st = {};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      request.expected = size_t(st.st_size);
+    }
+    request.content.resize(request.expected > 0 ? request.expected
+                                                : kInitialChunk);
+  }
+  while (request.offset < request.content.size()) {
+    char* data = &request.content[0] + request.offset;
+    auto length = request.content.size() - request.offset;
+    auto bytes = is_read ? ::read(fd, data, length) : ::write(fd, data, length);
+    if (bytes < 0) {
+      if (errno == EINTR) { continue; }
+      request.error = errno;
+      break;
+    }
+    if (is_read) {
+      if (AfterRead(request, size_t(bytes))) { break; }
+    } else {
+      if (bytes == 0) {
+        request.error = EIO;
+        break;
+      }
+      request.offset += size_t(bytes);
+    }
+  }
+  if (::close(fd) != 0 && !is_read && request.error == 0) {
+    request.error = errno;
+  }
+}
+
+//////////////////////////////// implementation ////////////////////////////////
+
+bool AsyncFileIO::Engine::AfterRead(Request& request, size_t bytes) {
+  request.offset += bytes;
+  bool done = bytes == 0 ||
+              (request.expected > 0 && request.offset >= request.expected);
+  if (done) {
+    request.content.resize(request.offset);
+  } else if (request.offset >= request.content.size()) {
+    request.content.resize(request.content.size() * 2);
+  }
+  return done;
+}
+
+AsyncFileIO::AsyncFileIO(Backend backend, int queue_depth, int num_threads) {
+  if (backend != Backend::kThreadPool) {
+    auto uring = std::make_unique<UringEngine>(this, queue_depth);
+    if (uring->ok()) {
+      backend_ = Backend::kIoUring;
+      engine_ = std::move(uring);
+      return;
+    }
+    if (backend == Backend::kIoUring) {
+      LOG(WARNING) << "io_uring is unavailable, fall back to thread pool.";
+    }
+  }
+  backend_ = Backend::kThreadPool;
+  engine_ = std::make_unique<PosixEngine>(this, num_threads);
+}
+
+AsyncFileIO::~AsyncFileIO() {
+  this->Wait();
+  engine_.reset();
+}
+
+void AsyncFileIO::AsyncReadFile(const std::string& file,
+                                ReadCallback callback) {
+  auto* request = new Request();
+  request->op = Request::Op::kRead;
+  request->file = file;
+  request->read_callback = std::move(callback);
+  this->Submit({request});
+}
+
+std::future<std::string> AsyncFileIO::AsyncReadFile(const std::string& file) {
+  auto promise = std::make_shared<std::promise<std::string>>();
+  auto result = promise->get_future();
+  this->AsyncReadFile(file, [promise](bool, std::string& content) {
+    promise->set_value(std::move(content));
+  });  // NOFORMAT(-2:)
+  return result;
+}
+
+void AsyncFileIO::AsyncWriteFile(const std::string& file, std::string content,
+                                 WriteCallback callback) {
+  MakeDirsForFile(file);
+  auto* request = new Request();
+  request->op = Request::Op::kWrite;
+  request->file = file;
+  request->content = std::move(content);
+  request->write_callback = std::move(callback);
+  this->Submit({request});
+}
+
+std::future<bool> AsyncFileIO::AsyncWriteFile(const std::string& file,
+                                              std::string content) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto result = promise->get_future();
+  this->AsyncWriteFile(file, std::move(content), [promise](bool ok) {
+    promise->set_value(ok);
+  });  // NOFORMAT(-2:)
+  return result;
+}
+
+std::vector<std::string> AsyncFileIO::ReadFiles(
+    const std::vector<std::string>& files) {
+  std::vector<std::string> results(files.size());
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t remaining = files.size();
+  std::vector<Request*> requests;
+  for (size_t i = 0; i < files.size(); ++i) {
+    auto* request = new Request();
+    request->op = Request::Op::kRead;
+    request->file = files[i];
+    request->read_callback = [&, i](bool, std::string& content) {
+      results[i].swap(content);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--remaining == 0) { condition.notify_all(); }
+    };
+    requests.push_back(request);
+  }
+  this->Submit(requests);
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [&remaining] { return remaining == 0; });
+  return results;
+}
+
+bool AsyncFileIO::WriteFiles(const std::vector<std::string>& files,
+                             std::vector<std::string> contents) {
+  CHECK_EQ(files.size(), contents.size());
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t remaining = files.size();
+  bool all_ok = true;
+  std::vector<Request*> requests;
+  for (size_t i = 0; i < files.size(); ++i) {
+    MakeDirsForFile(files[i]);
+    auto* request = new Request();
+    request->op = Request::Op::kWrite;
+    request->file = files[i];
+    request->content = std::move(contents[i]);
+    request->write_callback = [&](bool ok) {
+      std::lock_guard<std::mutex> lock(mutex);
+      all_ok = all_ok && ok;
+      if (--remaining == 0) { condition.notify_all(); }
+    };
+    requests.push_back(request);
+  }
+  this->Submit(requests);
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [&remaining] { return remaining == 0; });
+  return all_ok;
+}
+
+void AsyncFileIO::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.wait(lock, [this] { return outstanding_ == 0; });
+}
+
+void AsyncFileIO::Submit(const std::vector<Request*>& requests) {
+  if (requests.empty()) { return; }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    outstanding_ += int64_t(requests.size());
+  }
+  engine_->Submit(requests);
+}
+
+void AsyncFileIO::Complete(Request* request, bool ok) {
+  bool is_read = request->op == Request::Op::kRead;
+  if (!ok) {
+    LOG(ERROR) << "failed to " << (is_read ? "read " : "write ")
+               << request->file << ": " << strerror(request->error);
+    request->content.clear();
+  }
+  if (is_read && request->read_callback) {
+    request->read_callback(ok, request->content);
+  } else if (!is_read && request->write_callback) {
+    request->write_callback(ok);
+  }
+  delete request;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (--outstanding_ == 0) { condition_.notify_all(); }
+}
@@ -0,0 +1,203 @@
+#include "cpu_topology.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <set>
+
+#include "directory.h"
+
+static const char* const kNodeDir = "/sys/devices/system/node";
+
+// sysfs中的文件大小总是4096, 不能按普通文件mmap, 这里只读第一行
+static bool ReadFirstLine(const std::string& file, std::string& line) {
+  std::ifstream stream(file);
+  return bool(std::getline(stream, line));
+}
+
+// 动态分配的cpu_set_t, 支持超过CPU_SETSIZE个cpu
+class CpuSet {
+ public:
+  explicit CpuSet(int num_cpus)
+      : num_cpus_(std::max(num_cpus, 1)),
+        size_(CPU_ALLOC_SIZE(num_cpus_)),
+        set_(CPU_ALLOC(num_cpus_)) {
+    CHECK(set_ != nullptr);
+    CPU_ZERO_S(size_, set_);
+  }
+  DISABLE_COPY_ASIGN(CpuSet);
+  DISABLE_MOVE_ASIGN(CpuSet);
+  ~CpuSet() { CPU_FREE(set_); }
+
+  size_t size() const { return size_; }
+  cpu_set_t* get() const { return set_; }
+  void Add(int cpu) { CPU_SET_S(cpu, size_, set_); }
+  std::vector<int> ToVector() const {
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < num_cpus_; ++cpu) {
+      if (CPU_ISSET_S(cpu, size_, set_)) { cpus.push_back(cpu); }
+    }
+    return cpus;
+  }
+
+ private:
+  int num_cpus_;
+  size_t size_;
+  cpu_set_t* set_;
+};
+
+// pid为0时是当前线程, 失败时返回空
+static std::vector<int> GetAffinity(pid_t pid) {
+  for (int num_cpus = CPU_SETSIZE; num_cpus <= (1 << 20); num_cpus *= 2) {
+    CpuSet set(num_cpus);
+    if (sched_getaffinity(pid, set.size(), set.get()) == 0) {
+      return set.ToVector();
+    }
+    if (errno != EINVAL) { break; }
+  }
+  PLOG(WARNING) << "sched_getaffinity() failed";
+  return {};
+}
+
+// 进程允许使用的cpu. 用主线程的affinity, 而不是调用线程的, 这样在已经
+// 绑定的worker中第一次调用时结果也一样.
+static std::vector<int> GetProcessAffinity() {
+  auto cpus = GetAffinity(getpid());
+  if (cpus.empty()) {
+    cpus.resize(std::max(1U, std::thread::hardware_concurrency()));
+    std::iota(cpus.begin(), cpus.end(), 0);
+  }
+  return cpus;
+}
+
+//////////////////////////////// implementation ////////////////////////////////
+
+const CpuTopology& CpuTopology::Get() {
+  static const CpuTopology topology = Load(kNodeDir, GetProcessAffinity());
+  return topology;
+}
+
+CpuTopology CpuTopology::Load(const std::string& node_dir,
+                              const std::vector<int>& allowed) {
+  std::set<int> allowed_set(allowed.begin(), allowed.end());
+  CpuTopology topology;
+  std::vector<DirEntry> entries;
+  ListEntries(node_dir, entries, NameFilter{"", "", "node[0-9]*"});
+  for (const auto& entry : entries) {
+    NumaNode node;
+    node.id = std::atoi(entry.name.c_str() + 4);
+    std::string line;
+    std::vector<int> cpus;
+    if (!ReadFirstLine(node_dir + "/" + entry.name + "/cpulist", line) ||
+        !ParseCpuList(line, cpus)) {
+      continue;
+    }
+    for (int cpu : cpus) {
+      if (allowed_set.erase(cpu) > 0) { node.cpus.push_back(cpu); }
+    }
+    if (!node.cpus.empty()) { topology.nodes.push_back(std::move(node)); }
+  }
+  auto& nodes = topology.nodes;
+  std::sort(nodes.begin(), nodes.end(),
+            [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+  // 不属于任何节点的cpu(包括完全没有NUMA信息的情况)归入节点0
+  if (!allowed_set.empty()) {
+    if (nodes.empty() || nodes.front().id != 0) {
+      nodes.insert(nodes.begin(), NumaNode());
+    }
+    auto& cpus = nodes.front().cpus;
+    cpus.insert(cpus.end(), allowed_set.begin(), allowed_set.end());
+    std::sort(cpus.begin(), cpus.end());
+  }
+  for (const auto& node : nodes) {
+    topology.cpus.insert(topology.cpus.end(), node.cpus.begin(),
+                         node.cpus.end());
+  }
+  std::sort(topology.cpus.begin(), topology.cpus.end());
+  return topology;
+}
+
+int CpuTopology::NodeIndexOf(int cpu) const {
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const auto& cpus = nodes[i].cpus;
+    if (std::binary_search(cpus.begin(), cpus.end(), cpu)) { return int(i); }
+  }
+  return -1;
+}
+
+std::vector<int> OrderCpus(const CpuTopology& topology, CpuAffinity affinity) {
+  std::vector<int> cpus;
+  if (affinity == CpuAffinity::kCompact) {
+    for (const auto& node : topology.nodes) {
+      cpus.insert(cpus.end(), node.cpus.begin(), node.cpus.end());
+    }
+  } else if (affinity == CpuAffinity::kScatter) {
+    for (size_t i = 0; cpus.size() < topology.cpus.size(); ++i) {
+      for (const auto& node : topology.nodes) {
+        if (i < node.cpus.size()) { cpus.push_back(node.cpus[i]); }
+      }
+    }
+  }
+  return cpus;
+}
+
+bool ParseCpuList(std::string_view content, std::vector<int>& cpus) {
+  cpus.clear();
+  // 去掉结尾的换行等空白
+  while (!content.empty() && std::isspace(uint8_t(content.back()))) {
+    content.remove_suffix(1);
+  }
+  const char* p = content.data();
+  const char* end = p + content.size();
+  while (p < end) {
+    int first = 0;
+    auto result = std::from_chars(p, end, first);
+    if (result.ec != std::errc() || first < 0) { return false; }
+    int last = first;
+    p = result.ptr;
+    if (p < end && *p == '-') {
+      result = std::from_chars(p + 1, end, last);
+      if (result.ec != std::errc() || last < first) { return false; }
+      p = result.ptr;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) { cpus.push_back(cpu); }
+    if (p < end && *p++ != ',') { return false; }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return true;
+}
+
+std::string FormatCpuList(const std::vector<int>& cpus) {
+  std::vector<int> sorted(cpus);
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  std::string result;
+  for (size_t i = 0; i < sorted.size();) {
+    size_t j = i;
+    while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1) { ++j; }
+    if (!result.empty()) { result.push_back(','); }
+    result += std::to_string(sorted[i]);
+    if (j > i) { result += "-" + std::to_string(sorted[j]); }
+    i = j + 1;
+  }
+  return result;
+}
+
+std::vector<int> GetThreadAffinity() { return GetAffinity(0); }
+
+bool SetThreadAffinity(const std::vector<int>& cpus) {
+  if (cpus.empty()) { return false; }
+  CpuSet set(*std::max_element(cpus.begin(), cpus.end()) + 1);
+  for (int cpu : cpus) {
+    if (cpu >= 0) { set.Add(cpu); }
+  }
+  return sched_setaffinity(0, set.size(), set.get()) == 0;
+}
+
+int GetCurrentCpu() { return sched_getcpu(); }
+
+void SetThreadName(const std::string& name) {
+  pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+}
@@ -0,0 +1,270 @@
+#include "directory.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// getdents64和inotify每次读取的缓冲区大小
+static const size_t kBufferSize = 64 * 1024;
+
+// getdents64返回的记录, glibc没有导出这个结构
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;  // NOLINT
+  unsigned char d_type;
+  char d_name[1];
+};
+
+static DirEntry::Type GetType(unsigned char d_type) {
+  switch (d_type) {
+    case DT_REG: return DirEntry::Type::kFile;
+    case DT_DIR: return DirEntry::Type::kDirectory;
+    case DT_LNK: return DirEntry::Type::kSymlink;
+    case DT_UNKNOWN: return DirEntry::Type::kUnknown;
+    default: return DirEntry::Type::kOther;
+  }
+}
+
+static DirEntry::Type GetType(const struct stat& st) {
+  if (S_ISREG(st.st_mode)) { return DirEntry::Type::kFile; }
+  if (S_ISDIR(st.st_mode)) { return DirEntry::Type::kDirectory; }
+  if (S_ISLNK(st.st_mode)) { return DirEntry::Type::kSymlink; }
+  return DirEntry::Type::kOther;
+}
+
+// 匹配[...]字符集合, pos指向'['之后. 没有对应的']'时返回false, 此时'['
+// 按普通字符处理; 否则pos移到']'之后, matched为是否匹配.
+static bool MatchClass(std::string_view pattern, size_t& pos, char c,
+                       bool& matched) {
+  const size_t size = pattern.size();
+  auto value = static_cast<unsigned char>(c);
+  size_t i = pos;
+  bool negate = i < size && (pattern[i] == '!' || pattern[i] == '^');
+  if (negate) { ++i; }
+  bool found = false;
+  // 紧跟在'['或者'[!'之后的']'是普通字符
+  for (bool first = true; i < size && (first || pattern[i] != ']'); ++i) {
+    first = false;
+    if (pattern[i] == '\\' && i + 1 < size) { ++i; }
+    auto low = static_cast<unsigned char>(pattern[i]);
+    auto high = low;
+    if (i + 2 < size && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+      i += 2;
+      if (pattern[i] == '\\' && i + 1 < size) { ++i; }
+      high = static_cast<unsigned char>(pattern[i]);
+    }
+    if (low <= value && value <= high) { found = true; }
+  }
+  if (i >= size) { return false; }
+  pos = i + 1;
+  matched = found != negate;
+  return true;
+}
+
+//////////////////////////////// implementation ////////////////////////////////
+
+// 逐字符匹配, 遇到*时记下位置, 后面失配时回到最近的*多吞一个字符.
+// 最坏情况是O(|pattern| * |name|), 不会像回溯的正则那样指数爆炸.
+bool GlobMatch(std::string_view pattern, std::string_view name) {
+  const size_t npos = std::string_view::npos;
+  size_t p = 0;
+  size_t n = 0;
+  size_t star_p = npos;
+  size_t star_n = 0;
+  while (n < name.size()) {
+    if (p < pattern.size()) {
+      char c = pattern[p];
+      if (c == '*') {
+        star_p = ++p;
+        star_n = n;
+        continue;
+      }
+      size_t next = p + 1;
+      bool matched = false;
+      if (c == '?') {
+        matched = true;
+      } else if (c != '[' || !MatchClass(pattern, next, name[n], matched)) {
+        if (c == '\\' && p + 1 < pattern.size()) {
+          c = pattern[p + 1];
+          next = p + 2;
+        }
+        matched = c == name[n];
+      }
+      if (matched) {
+        p = next;
+        ++n;
+        continue;
+      }
+    }
+    if (star_p == npos) { return false; }
+    p = star_p;
+    n = ++star_n;
+  }
+  while (p < pattern.size() && pattern[p] == '*') { ++p; }
+  return p == pattern.size();
+}
+
+bool NameFilter::Match(std::string_view name) const {
+  if (name.size() < prefix.size() || name.size() < suffix.size()) {
+    return false;
+  }
+  if (name.compare(0, prefix.size(), prefix) != 0) { return false; }
+  if (name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+    return false;
+  }
+  return glob.empty() || GlobMatch(glob, name);
+}
+
+bool ListEntries(const std::string& dirname, std::vector<DirEntry>& entries,
+                 const NameFilter& filter) {
+  int fd = ::open(dirname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) { return false; }
+  // 按8字节对齐, 与内核填充的记录一致
+  std::vector<uint64_t> buffer(kBufferSize / sizeof(uint64_t));
+  auto* data = reinterpret_cast<char*>(buffer.data());
+  bool ok = true;
+  while (true) {
+    auto bytes = syscall(SYS_getdents64, fd, data, kBufferSize);
+    if (bytes < 0 && errno == EINTR) { continue; }
+    if (bytes <= 0) {
+      ok = bytes == 0;
+      break;
+    }
+    for (long offset = 0; offset < bytes;) {  // NOLINT
+      auto* record = reinterpret_cast<LinuxDirent64*>(data + offset);
+      offset += record->d_reclen;
+      std::string_view name(record->d_name);
+      if (name == "." || name == ".." || !filter.Match(name)) { continue; }
+      DirEntry entry;
+      entry.name = std::string(name);
+      entry.inode = record->d_ino;
+      entry.type = GetType(record->d_type);
+      struct stat st = {};
+      if (entry.type == DirEntry::Type::kUnknown &&
+          fstatat(fd, record->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        entry.type = GetType(st);
+      }
+      entries.push_back(std::move(entry));
+    }
+  }
+  ::close(fd);
+  return ok;
+}
+
+DirectoryIndex::DirectoryIndex(const std::string& dirname,
+                               const NameFilter& filter)
+    : dirname_(dirname), filter_(filter), buffer_(kBufferSize) {
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    LOG(ERROR) << "inotify_init1() failed! " << strerror(errno);
+    return;
+  }
+  // 先开始监视再扫描, 扫描期间的变化不会漏掉
+  const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+  if (inotify_add_watch(inotify_fd_, dirname.c_str(), mask) < 0) {
+    LOG(ERROR) << "failed to watch " << dirname << ": " << strerror(errno);
+    this->Close();
+    return;
+  }
+  this->Rescan(nullptr, nullptr);
+}
+
+DirectoryIndex::~DirectoryIndex() { this->Close(); }
+
+void DirectoryIndex::Close() {
+  if (inotify_fd_ >= 0) { ::close(inotify_fd_); }
+  inotify_fd_ = -1;
+}
+
+// 同一次Update中先创建后删除的文件会同时出现在added和removed中
+bool DirectoryIndex::Update(std::vector<std::string>* added,
+                            std::vector<std::string>* removed) {
+  if (inotify_fd_ < 0) { return false; }
+  bool rescan = false;
+  bool gone = false;
+  while (!gone) {
+    auto bytes = ::read(inotify_fd_, buffer_.data(), buffer_.size());
+    if (bytes < 0 && errno == EINTR) { continue; }
+    if (bytes <= 0) {
+      if (bytes < 0 && errno != EAGAIN) {
+        LOG(ERROR) << "failed to read inotify events: " << strerror(errno);
+      }
+      break;
+    }
+    for (ssize_t offset = 0; offset < bytes;) {
+      auto* event = reinterpret_cast<inotify_event*>(&buffer_[offset]);
+      offset += ssize_t(sizeof(inotify_event) + event->len);
+      if (event->mask & IN_Q_OVERFLOW) { rescan = true; }
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        gone = true;
+      }
+      if (event->len == 0 || !filter_.Match(event->name)) { continue; }
+      std::string name(event->name);
+      if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        struct stat st = {};
+        auto path = dirname_ + "/" + name;
+        // 已经被删除的话, 后面会有对应的删除事件
+        if (lstat(path.c_str(), &st) != 0) { continue; }
+        DirEntry entry;
+        entry.name = name;
+        entry.type = GetType(st);
+        entry.inode = st.st_ino;
+        entries_[name] = std::move(entry);
+        if (added != nullptr) { added->push_back(name); }
+      } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (entries_.erase(name) > 0 && removed != nullptr) {
+          removed->push_back(name);
+        }
+      }
+    }
+  }
+  if (gone) {
+    if (removed != nullptr) {
+      for (const auto& pair : entries_) { removed->push_back(pair.first); }
+    }
+    entries_.clear();
+    this->Close();
+    return false;
+  }
+  if (rescan) {
+    LOG(WARNING) << "inotify queue overflowed, rescan " << dirname_;
+    this->Rescan(added, removed);
+  }
+  return inotify_fd_ >= 0;
+}
+
+std::vector<std::string> DirectoryIndex::List() {
+  this->Update();
+  std::vector<std::string> names;
+  names.reserve(entries_.size());
+  for (const auto& pair : entries_) { names.push_back(pair.first); }
+  return names;
+}
+
+void DirectoryIndex::Rescan(std::vector<std::string>* added,
+                            std::vector<std::string>* removed) {
+  std::vector<DirEntry> scanned;
+  if (!ListEntries(dirname_, scanned, filter_)) {
+    LOG(ERROR) << "failed to list " << dirname_ << ": " << strerror(errno);
+    this->Close();
+  }
+  std::map<std::string, DirEntry> entries;
+  for (auto& entry : scanned) {
+    auto name = entry.name;
+    if (added != nullptr && entries_.count(name) == 0) {
+      added->push_back(name);
+    }
+    entries.emplace(std::move(name), std::move(entry));
+  }
+  if (removed != nullptr) {
+    for (const auto& pair : entries_) {
+      if (entries.count(pair.first) == 0) { removed->push_back(pair.first); }
+    }
+  }
+  entries_.swap(entries);
+}
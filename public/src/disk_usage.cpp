@@ -0,0 +1,186 @@
+#include "disk_usage.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// linux系统中, 一个文件夹占4096个字节
+static const int64_t kEmptyDirSize = 4096;
+
+// 内核更新mtime用的是粗粒度时钟, 同一个时钟周期内先后发生的两次修改
+// mtime相同. 所以mtime离现在太近的目录不放入缓存, 以免漏掉后续的修改.
+static const int64_t kRacyWindow = 100 * 1000000;  // 纳秒
+
+static int64_t GetModifyTime(const struct stat& st) {
+  return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static bool IsRacy(const struct stat& st) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  auto nanoseconds = std::chrono::nanoseconds(now).count();
+  return nanoseconds - GetModifyTime(st) < kRacyWindow;
+}
+
+// 待扫描的目录组成一个共享的栈, 调用线程和pool中的辅助任务一起从栈中取目录.
+// 调用线程一直参与到统计结束; 辅助任务在栈空时就退出, 不占着worker等待,
+// 栈中有新的子目录时再按需提交. 辅助任务可能在统计结束之后才开始运行,
+// 所以状态由shared_ptr持有.
+struct DiskUsage::ScanState {
+  DiskUsage* owner = nullptr;
+  std::mutex mutex;
+  std::condition_variable condition;  // 只有调用线程等待
+  std::vector<std::string> pending;
+  int active = 0;
+  int helpers = 0;  // 已经提交但是还没有退出的辅助任务
+  bool done = false;
+  std::atomic<int64_t> total{0};
+  // 本次扫描到的目录, 开启缓存时用于清理已经不存在的目录
+  std::unordered_set<std::string> visited;
+};
+
+//////////////////////////////// implementation ////////////////////////////////
+
+int64_t DiskUsage::GetSize(const std::string& path) {
+  struct stat st = {};
+  if (::stat(path.c_str(), &st) != 0) { return -1; }
+  if (S_ISREG(st.st_mode)) { return st.st_size; }
+  if (!S_ISDIR(st.st_mode)) { return -1; }
+
+  auto state = std::make_shared<ScanState>();
+  state->owner = this;
+  state->pending.push_back(path);
+  RunScan(state, true);
+  if (enable_cache_) { PruneCache(path, state->visited); }
+  return state->total.load();
+}
+
+void DiskUsage::ClearCache() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cache_.clear();
+}
+
+int DiskUsage::num_cached() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return int(cache_.size());
+}
+
+void DiskUsage::RunScan(const std::shared_ptr<ScanState>& state,
+                        bool is_caller) {
+  std::vector<std::string> subdirs;
+  std::unique_lock<std::mutex> lock(state->mutex);
+  while (true) {
+    if (is_caller) {
+      state->condition.wait(lock, [&state] {
+        return state->done || !state->pending.empty();
+      });  // NOFORMAT(-2:)
+      if (state->done) { return; }
+    } else if (state->pending.empty()) {
+      state->helpers -= 1;
+      return;
+    }
+    auto path = std::move(state->pending.back());
+    state->pending.pop_back();
+    if (state->owner->enable_cache_) { state->visited.insert(path); }
+    state->active += 1;
+    lock.unlock();
+
+    subdirs.clear();
+    state->total += state->owner->ScanDirectory(path, subdirs);
+
+    lock.lock();
+    state->active -= 1;
+    for (auto& subdir : subdirs) {
+      state->pending.push_back(std::move(subdir));
+    }
+    if (state->pending.empty() && state->active == 0) {
+      state->done = true;
+      state->condition.notify_one();
+    } else if (!subdirs.empty()) {
+      state->condition.notify_one();
+    }
+    // pool中的worker可能正忙于其他任务, 辅助任务最多与worker一样多
+    auto* pool = state->owner->pool_;
+    if (pool != nullptr) {
+      int count = std::min(int(state->pending.size()),
+                           pool->size() - state->helpers);
+      for (int i = 0; i < count; ++i) {
+        state->helpers += 1;
+        pool->post([state] { RunScan(state, false); });
+      }
+    }
+  }
+}
+
+void DiskUsage::PruneCache(const std::string& root,
+                           const std::unordered_set<std::string>& visited) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto iter = cache_.begin(); iter != cache_.end();) {
+    const auto& path = iter->first;
+    bool inside = path.compare(0, root.size(), root) == 0 &&
+                  (path.size() == root.size() || path[root.size()] == '/');
+    if (inside && visited.count(path) == 0) {
+      iter = cache_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+int64_t DiskUsage::ScanDirectory(const std::string& path,
+                                 std::vector<std::string>& subdirs) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  // 没有权限的目录只计目录本身的大小
+  if (fd < 0) { return kEmptyDirSize; }
+
+  struct stat st = {};
+  if (enable_cache_ && ::fstat(fd, &st) == 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = cache_.find(path);
+    if (iter != cache_.end() && iter->second.inode == st.st_ino &&
+        iter->second.mtime == GetModifyTime(st)) {
+      ::close(fd);
+      subdirs = iter->second.subdirs;
+      return kEmptyDirSize + iter->second.file_bytes;
+    }
+  }
+
+  DIR* dir = ::fdopendir(fd);
+  if (dir == nullptr) {
+    ::close(fd);
+    return kEmptyDirSize;
+  }
+  int64_t file_bytes = 0;
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    const char* name = entry->d_name;
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+    auto type = entry->d_type;
+    struct stat child = {};
+    if (type == DT_REG || type == DT_UNKNOWN) {
+      if (::fstatat(fd, name, &child, AT_SYMLINK_NOFOLLOW) != 0) { continue; }
+      if (S_ISREG(child.st_mode)) {
+        file_bytes += child.st_size;
+        continue;
+      }
+      type = S_ISDIR(child.st_mode) ? DT_DIR : DT_UNKNOWN;
+    }
+    if (type == DT_DIR) { subdirs.push_back(path + "/" + name); }
+  }
+  // closedir会同时关闭fd
+  ::closedir(dir);
+
+  if (enable_cache_ && st.st_ino != 0 && !IsRacy(st)) {
+    CacheEntry entry;
+    entry.inode = st.st_ino;
+    entry.mtime = GetModifyTime(st);
+    entry.file_bytes = file_bytes;
+    entry.subdirs = subdirs;
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_[path] = std::move(entry);
+  }
+  return kEmptyDirSize + file_bytes;
+}
@@ -0,0 +1,247 @@
+#include "file_writer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <unordered_map>
+
+#include "parallel.h"
+
+FileWriter::FileWriter(Durability durability, int num_threads, int max_batch)
+    : durability_(durability),
+      max_batch_(std::max(max_batch, 1)),
+      pool_(std::max(num_threads, 1)) {
+  thread_ = std::thread([this] { this->Run(); });
+}
+
+FileWriter::~FileWriter() {
+  ATOMIC_SET(mutex_, stop_, true);
+  condition_.notify_all();
+  thread_.join();
+}
+
+void FileWriter::Write(const std::string& file, std::string content,
+                       Callback callback) {
+  Item item;
+  item.file = file;
+  item.content = std::move(content);
+  item.callback = std::move(callback);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!stop_) << "Writing is not allowed when the writer is stopped.";
+    pending_.push_back(std::move(item));
+    ++submitted_;
+  }
+  condition_.notify_one();
+}
+
+std::future<bool> FileWriter::Write(const std::string& file,
+                                    std::string content) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto result = promise->get_future();
+  this->Write(file, std::move(content), [promise](bool ok) {
+    promise->set_value(ok);
+  });  // NOFORMAT(-2:)
+  return result;
+}
+
+std::future<bool> FileWriter::WriteJson(const Json::Value& root,
+                                        const std::string& json_file) {
+  Json::StreamWriterBuilder builder;
+  return this->Write(json_file, Json::writeString(builder, root));
+}
+
+void FileWriter::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto target = submitted_;
+  flushed_.wait(lock, [this, target] { return completed_ >= target; });
+}
+
+void FileWriter::Run() {
+  std::vector<Item> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+      if (pending_.empty()) { return; }
+      // 上一组提交期间到达的文件组成新的一组
+      while (!pending_.empty() && batch.size() < max_batch_) {
+        batch.push_back(std::move(pending_.front()));
+        pending_.pop_front();
+      }
+    }
+    this->Commit(batch);
+    num_batches_.fetch_add(1);
+    num_files_.fetch_add(int64_t(batch.size()));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      completed_ += int64_t(batch.size());
+    }
+    flushed_.notify_all();
+    batch.clear();
+  }
+}
+
+void FileWriter::Commit(std::vector<Item>& batch) {
+  // 需要fsync的目录: 文件所在的目录, 以及新建目录的上一级目录
+  std::vector<std::string> sync_dirs;
+  std::vector<std::string> dirnames;
+  for (auto& item : batch) {
+    auto dirname =
+        boost::filesystem::absolute(item.file).parent_path().string();
+    item.ok = this->MakeDirs(dirname, &sync_dirs);
+    if (durability_ != Durability::kNone) {
+      item.temp = item.file + ".tmp." + std::to_string(getpid()) + "." +
+                  std::to_string(sequence_.fetch_add(1));
+    }
+    dirnames.push_back(dirname);
+  }
+
+  // kNone直接写目标文件, 同一个文件在一组中出现多次时并发写会互相截断,
+  // 所以只写最后一次提交的内容, 前面的几次跟随它的结果
+  std::vector<size_t> last(batch.size());
+  std::iota(last.begin(), last.end(), 0);
+  if (durability_ == Durability::kNone) {
+    std::unordered_map<std::string, size_t> latest;
+    for (size_t i = batch.size(); i-- > 0;) {
+      last[i] = latest.emplace(batch[i].file, i).first->second;
+    }
+  }
+
+  // 写入和fdatasync可以并行, 并发的fsync会被文件系统合并
+  ParallelFor(
+      pool_, 0, int64_t(batch.size()),
+      [this, &batch, &last](int64_t i) {
+        if (batch[i].ok && last[i] == size_t(i)) {
+          batch[i].ok = this->WriteItem(batch[i]);
+        }
+      },
+      1);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (last[i] != i && batch[i].ok) { batch[i].ok = batch[last[i]].ok; }
+  }
+
+  // rename必须按提交顺序, 同一个文件写多次时最后一次生效
+  if (durability_ != Durability::kNone) {
+    for (auto& item : batch) {
+      if (!item.ok) { continue; }
+      if (::rename(item.temp.c_str(), item.file.c_str()) != 0) {
+        LOG(ERROR) << "failed to rename " << item.temp << " to " << item.file
+                   << ": " << strerror(errno);
+        ::unlink(item.temp.c_str());
+        item.ok = false;
+      }
+    }
+  }
+
+  if (durability_ == Durability::kDurable) {
+    sync_dirs.insert(sync_dirs.end(), dirnames.begin(), dirnames.end());
+    std::sort(sync_dirs.begin(), sync_dirs.end());
+    sync_dirs.erase(std::unique(sync_dirs.begin(), sync_dirs.end()),
+                    sync_dirs.end());
+    std::vector<char> synced(sync_dirs.size(), 0);
+    ParallelFor(
+        pool_, 0, int64_t(sync_dirs.size()),
+        [&sync_dirs, &synced](int64_t i) {
+          int fd = ::open(sync_dirs[i].c_str(), O_RDONLY | O_DIRECTORY);
+          synced[i] = fd >= 0 && ::fsync(fd) == 0;
+          if (!synced[i]) {
+            LOG(ERROR) << "failed to fsync " << sync_dirs[i] << ": "
+                       << strerror(errno);
+          }
+          if (fd >= 0) { ::close(fd); }
+        },
+        1);
+    // 目录没有落盘的话, 其中的rename也不能算落盘
+    for (size_t i = 0; i < batch.size(); ++i) {
+      auto it = std::lower_bound(sync_dirs.begin(), sync_dirs.end(),
+                                 dirnames[i]);
+      if (!synced[it - sync_dirs.begin()]) { batch[i].ok = false; }
+    }
+  }
+
+  for (auto& item : batch) {
+    if (item.callback) { item.callback(item.ok); }
+  }
+}
+
+bool FileWriter::WriteItem(Item& item) {
+  const auto& target = item.temp.empty() ? item.file : item.temp;
+  const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  int fd = ::open(target.c_str(), flags, 0644);
+  if (fd < 0 && errno == ENOENT) {
+    // 缓存中的目录可能在外部被删除了, 重新创建一次
+    auto dirname =
+        boost::filesystem::absolute(item.file).parent_path().string();
+    {
+      std::lock_guard<std::mutex> lock(dirs_mutex_);
+      dirs_.erase(dirname);
+    }
+    if (this->MakeDirs(dirname, nullptr)) {
+      fd = ::open(target.c_str(), flags, 0644);
+    }
+  }
+  if (fd < 0) {
+    LOG(ERROR) << "failed to open " << target << ": " << strerror(errno);
+    return false;
+  }
+  // 临时文件rename之后会替换原文件, 沿用原文件的权限, 与原地写入时一致
+  struct stat st = {};
+  if (!item.temp.empty() && ::stat(item.file.c_str(), &st) == 0 &&
+      ::fchmod(fd, st.st_mode & 07777) != 0) {
+    PLOG(WARNING) << "failed to chmod " << target;
+  }
+
+  bool ok = true;
+  size_t offset = 0;
+  while (offset < item.content.size()) {
+    auto bytes = ::write(fd, item.content.data() + offset,
+                         item.content.size() - offset);
+    if (bytes < 0 && errno == EINTR) { continue; }
+    if (bytes <= 0) {
+      ok = false;
+      break;
+    }
+    offset += size_t(bytes);
+  }
+  if (ok && durability_ == Durability::kDurable && ::fdatasync(fd) != 0) {
+    ok = false;
+  }
+  if (::close(fd) != 0) { ok = false; }
+  if (!ok) {
+    LOG(ERROR) << "failed to write " << target << ": " << strerror(errno);
+    if (!item.temp.empty()) { ::unlink(item.temp.c_str()); }
+  }
+  return ok;
+}
+
+bool FileWriter::MakeDirs(const std::string& dirname,
+                          std::vector<std::string>* new_parents) {
+  {
+    std::lock_guard<std::mutex> lock(dirs_mutex_);
+    if (dirs_.count(dirname) > 0) { return true; }
+  }
+  namespace fs = boost::filesystem;
+  // 逐级找出需要新建的目录, 它们的上一级目录中多了一项, 也需要fsync
+  std::vector<fs::path> created;
+  for (fs::path path(dirname); !path.empty() && !fs::exists(path);
+       path = path.parent_path()) {
+    created.push_back(path);
+  }
+  boost::system::error_code error;
+  fs::create_directories(dirname, error);
+  if (error) {
+    LOG(ERROR) << "failed to create directory " << dirname << ": "
+               << error.message();
+    return false;
+  }
+  if (new_parents != nullptr) {
+    for (const auto& path : created) {
+      new_parents->push_back(path.parent_path().string());
+    }
+  }
+  std::lock_guard<std::mutex> lock(dirs_mutex_);
+  dirs_.insert(dirname);
+  return true;
+}
@@ -0,0 +1,227 @@
+#include "json_lines.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// 空行, 包括只有\r等空白字符的行
+static bool IsBlank(std::string_view line) {
+  for (char c : line) {
+    if (!std::isspace(static_cast<unsigned char>(c))) { return false; }
+  }
+  return true;
+}
+
+static bool ParseLine(std::string_view line, Json::Value& record,
+                      std::string& error) {
+  const char* begin = line.data();
+  return ThreadLocalJsonReader().parse(begin, begin + line.size(), &record,
+                                       &error);
+}
+
+// 把写入的内容直接追加到std::string, 省掉ostringstream的一次拷贝
+class JsonLinesWriter::AppendBuf : public std::streambuf {
+ public:
+  explicit AppendBuf(std::string& buffer) : buffer_(buffer) {}
+
+ protected:
+  int_type overflow(int_type c) override {
+    if (c != traits_type::eof()) { buffer_.push_back(char(c)); }
+    return traits_type::not_eof(c);
+  }
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    buffer_.append(s, size_t(n));
+    return n;
+  }
+
+ private:
+  std::string& buffer_;
+};
+
+//////////////////////////////// implementation ////////////////////////////////
+
+Json::CharReader& ThreadLocalJsonReader() {
+  thread_local std::unique_ptr<Json::CharReader> reader(
+      Json::CharReaderBuilder().newCharReader());
+  return *reader;
+}
+
+Json::StreamWriter& ThreadLocalJsonWriter() {
+  thread_local std::unique_ptr<Json::StreamWriter> writer([] {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return builder.newStreamWriter();
+  }());
+  return *writer;
+}
+
+JsonLinesReader::JsonLinesReader(const std::string& file, bool use_mmap,
+                                 size_t buffer_size) {
+  // /proc下的文件等大小为0, 不能通过mmap读取
+  if (use_mmap && mapped_.Open(file, MappedFile::Advice::kSequential) &&
+      !mapped_.empty()) {
+    remaining_ = mapped_.view();
+    return;
+  }
+  mapped_.Close();
+  fd_ = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    LOG(ERROR) << "failed to open " << file << ": " << strerror(errno);
+    return;
+  }
+  buffer_.resize(std::max<size_t>(buffer_size, 1));
+}
+
+JsonLinesReader::~JsonLinesReader() {
+  if (fd_ >= 0) { ::close(fd_); }
+}
+
+bool JsonLinesReader::Next(Json::Value& record) {
+  std::string_view line;
+  std::string error;
+  while (this->NextLine(line)) {
+    ++line_number_;
+    if (IsBlank(line)) { continue; }
+    if (ParseLine(line, record, error)) { return true; }
+    ++num_errors_;
+    LOG(ERROR) << "failed to parse json line " << line_number_
+               << ", error: " << error;
+  }
+  return false;
+}
+
+bool JsonLinesReader::NextLine(std::string_view& line) {
+  if (mapped_.is_open()) {
+    if (remaining_.empty()) { return false; }
+    auto pos = std::min(remaining_.find('\n'), remaining_.size());
+    line = remaining_.substr(0, pos);
+    remaining_.remove_prefix(std::min(pos + 1, remaining_.size()));
+    return true;
+  }
+  if (fd_ < 0) { return false; }
+
+  size_t scanned = 0;  // [begin_, begin_ + scanned)中已经确认没有换行符
+  while (true) {
+    const char* start = buffer_.data() + begin_;
+    const void* newline =
+        memchr(start + scanned, '\n', end_ - begin_ - scanned);
+    if (newline != nullptr) {
+      auto length = size_t(static_cast<const char*>(newline) - start);
+      line = std::string_view(start, length);
+      begin_ += length + 1;
+      return true;
+    }
+    scanned = end_ - begin_;
+    if (!this->Fill()) {
+      // 最后一行没有换行符
+      if (begin_ == end_) { return false; }
+      line = std::string_view(buffer_.data() + begin_, end_ - begin_);
+      begin_ = end_;
+      return true;
+    }
+  }
+}
+
+bool JsonLinesReader::Fill() {
+  if (eof_) { return false; }
+  if (begin_ > 0) {
+    std::memmove(&buffer_[0], buffer_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+  }
+  // 一行比缓冲区还长
+  if (end_ == buffer_.size()) { buffer_.resize(buffer_.size() * 2); }
+  while (true) {
+    auto bytes = ::read(fd_, &buffer_[end_], buffer_.size() - end_);
+    if (bytes > 0) {
+      end_ += size_t(bytes);
+      return true;
+    }
+    if (bytes < 0 && errno == EINTR) { continue; }
+    if (bytes < 0) { LOG(ERROR) << "failed to read: " << strerror(errno); }
+    eof_ = true;
+    return false;
+  }
+}
+
+std::vector<Json::Value> JsonLinesReader::ReadAll(const std::string& file,
+                                                  ThreadPool& pool) {
+  std::vector<Json::Value> records;
+  auto append = [&records](std::vector<Json::Value>& batch) {
+    if (records.empty()) {
+      records.swap(batch);
+    } else {
+      records.insert(records.end(), std::make_move_iterator(batch.begin()),
+                     std::make_move_iterator(batch.end()));
+    }
+  };
+  ReadInBatches(file, pool, append);
+  return records;
+}
+
+int64_t JsonLinesReader::ParseChunk(std::string_view chunk,
+                                    std::vector<Json::Value>& records) {
+  int64_t num_errors = 0;
+  std::string error;
+  Json::Value record;
+  while (!chunk.empty()) {
+    auto pos = std::min(chunk.find('\n'), chunk.size());
+    auto line = chunk.substr(0, pos);
+    chunk.remove_prefix(std::min(pos + 1, chunk.size()));
+    if (IsBlank(line)) { continue; }
+    if (ParseLine(line, record, error)) {
+      records.push_back(std::move(record));
+    } else {
+      ++num_errors;
+      LOG(ERROR) << "failed to parse json line, error: " << error;
+    }
+  }
+  return num_errors;
+}
+
+JsonLinesWriter::JsonLinesWriter(const std::string& file, bool append,
+                                 size_t buffer_size)
+    : buffer_size_(std::max<size_t>(buffer_size, 1)),
+      streambuf_(new AppendBuf(buffer_)),
+      stream_(new std::ostream(streambuf_.get())) {
+  MakeDirsForFile(file);
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+  fd_ = ::open(file.c_str(), flags, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "failed to open " << file << ": " << strerror(errno);
+  }
+  buffer_.reserve(buffer_size_ + 4096);
+}
+
+JsonLinesWriter::~JsonLinesWriter() {
+  if (fd_ < 0) { return; }
+  this->Flush();
+  ::close(fd_);
+}
+
+bool JsonLinesWriter::Write(const Json::Value& record) {
+  if (fd_ < 0) { return false; }
+  ThreadLocalJsonWriter().write(record, stream_.get());
+  buffer_.push_back('\n');
+  if (buffer_.size() >= buffer_size_) { return this->Flush(); }
+  return true;
+}
+
+bool JsonLinesWriter::Flush() {
+  if (fd_ < 0) { return false; }
+  size_t offset = 0;
+  bool ok = true;
+  while (offset < buffer_.size()) {
+    auto bytes = ::write(fd_, buffer_.data() + offset, buffer_.size() - offset);
+    if (bytes < 0 && errno == EINTR) { continue; }
+    if (bytes <= 0) {
+      LOG(ERROR) << "failed to write: " << strerror(errno);
+      ok = false;
+      break;
+    }
+    offset += size_t(bytes);
+  }
+  buffer_.clear();
+  return ok;
+}
@@ -0,0 +1,66 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int GetAdvice(MappedFile::Advice advice) {
+  switch (advice) {
+    case MappedFile::Advice::kNormal: return MADV_NORMAL;
+    case MappedFile::Advice::kSequential: return MADV_SEQUENTIAL;
+    case MappedFile::Advice::kRandom: return MADV_RANDOM;
+    case MappedFile::Advice::kWillNeed: return MADV_WILLNEED;
+    case MappedFile::Advice::kDontNeed: return MADV_DONTNEED;
+  }
+  return MADV_NORMAL;
+}
+
+//////////////////////////////// implementation ////////////////////////////////
+
+MappedFile::MappedFile(const std::string& file, Advice advice) {
+  this->Open(file, advice);
+}
+
+bool MappedFile::Open(const std::string& file, Advice advice) {
+  this->Close();
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) { return false; }
+  struct stat st = {};
+  if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      LOG(WARNING) << "mmap() failed! " << file << ": " << strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    data_ = static_cast<const char*>(addr);
+    size_ = st.st_size;
+  }
+  // 映射建立之后就不再需要文件描述符了
+  ::close(fd);
+  is_open_ = true;
+  this->Advise(advice);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) { ::munmap(const_cast<char*>(data_), size_); }
+  data_ = nullptr;
+  size_ = 0;
+  is_open_ = false;
+}
+
+void MappedFile::Advise(Advice advice, size_t offset, size_t length) const {
+  if (data_ == nullptr || offset >= size_) { return; }
+  // madvise要求起始地址按页对齐
+  static const size_t page_size = ::sysconf(_SC_PAGESIZE);
+  size_t aligned = offset / page_size * page_size;
+  if (length == 0 || offset + length > size_) { length = size_ - offset; }
+  length += offset - aligned;
+  ::madvise(const_cast<char*>(data_) + aligned, length, GetAdvice(advice));
+}
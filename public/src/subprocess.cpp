@@ -0,0 +1,206 @@
+#include "subprocess.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+extern char** environ;  // NOLINT
+
+// 每次read的最大字节数
+static const size_t kReadSize = 64 * 1024;
+// 内核不支持pidfd时, 检查子进程是否退出的间隔
+static const int kPollIntervalMs = 10;
+
+static int OpenPidFd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return int(syscall(SYS_pidfd_open, pid, 0));
+#else
+  return -1;
+#endif
+}
+
+// 读完fd中当前可读的内容, 读到文件尾时关闭fd并置为-1
+static void Drain(int& fd, std::string& output, char* buffer) {
+  while (fd >= 0) {
+    auto bytes = ::read(fd, buffer, kReadSize);
+    if (bytes > 0) {
+      output.append(buffer, size_t(bytes));
+      continue;
+    }
+    if (bytes < 0 && errno == EINTR) { continue; }
+    if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { return; }
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+//////////////////////////////// implementation ////////////////////////////////
+
+Subprocess::Subprocess(std::vector<std::string> argv, const Options& options)
+    : argv_(std::move(argv)), options_(options) {}
+
+Subprocess::~Subprocess() {
+  if (pid_ > 0 && !reaped_) {
+    ::kill(pid_, SIGKILL);
+    int status = 0;
+    while (::waitpid(pid_, &status, 0) < 0 && errno == EINTR) {}
+  }
+  this->CloseFds();
+}
+
+void Subprocess::CloseFds() {
+  for (int* fd : {&out_fd_, &err_fd_, &pid_fd_}) {
+    if (*fd >= 0) { ::close(*fd); }
+    *fd = -1;
+  }
+}
+
+bool Subprocess::Start() {
+  CHECK_LT(pid_, 0) << "Subprocess can only be started once.";
+  if (argv_.empty()) {
+    LOG(ERROR) << "failed to spawn: empty argv";
+    return false;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (!options_.inherit_stdin) {
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  }
+  // 所有管道都带O_CLOEXEC, 同时启动的其他子进程不会继承它们,
+  // 否则这里永远读不到文件尾
+  int pipes[2][2] = {{-1, -1}, {-1, -1}};
+  bool captures[2] = {options_.capture_stdout, options_.capture_stderr};
+  bool ok = true;
+  for (int i = 0; i < 2 && ok; ++i) {
+    if (!captures[i]) { continue; }
+    ok = ::pipe2(pipes[i], O_CLOEXEC) == 0;
+    if (ok) {
+      posix_spawn_file_actions_adddup2(&actions, pipes[i][1], i + 1);
+      fcntl(pipes[i][0], F_SETFL, fcntl(pipes[i][0], F_GETFL) | O_NONBLOCK);
+    }
+  }
+
+  int error = ok ? 0 : errno;
+  if (ok) {
+    std::vector<char*> args;
+    for (auto& arg : argv_) { args.push_back(&arg[0]); }
+    args.push_back(nullptr);
+    error = posix_spawnp(&pid_, args[0], &actions, nullptr, args.data(),
+                         environ);
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  for (auto& pipe : pipes) {
+    if (pipe[1] >= 0) { ::close(pipe[1]); }
+  }
+  out_fd_ = pipes[0][0];
+  err_fd_ = pipes[1][0];
+  if (error != 0) {
+    LOG(ERROR) << "failed to spawn " << argv_[0] << ": " << strerror(error);
+    pid_ = -1;
+    this->CloseFds();
+    return false;
+  }
+  pid_fd_ = OpenPidFd(pid_);
+  start_time_ = std::chrono::steady_clock::now();
+  result_.started = true;
+  return true;
+}
+
+SubprocessResult Subprocess::Wait() {
+  CHECK(!waited_) << "Subprocess can only be waited once.";
+  waited_ = true;
+  if (pid_ < 0) { return result_; }
+
+  using Clock = std::chrono::steady_clock;
+  const bool has_deadline = options_.timeout.count() > 0;
+  const auto deadline = start_time_ + options_.timeout;
+  std::vector<char> buffer(kReadSize);
+  bool exited = false;
+  int status = 0;
+  while (!exited || out_fd_ >= 0 || err_fd_ >= 0) {
+    int timeout_ms = -1;
+    if (has_deadline) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - Clock::now());
+      timeout_ms = int(std::max<int64_t>(remaining.count() + 1, 0));
+    }
+    if (!exited && pid_fd_ < 0) {
+      timeout_ms = timeout_ms < 0 ? kPollIntervalMs
+                                  : std::min(timeout_ms, kPollIntervalMs);
+    }
+    pollfd fds[3];
+    int num_fds = 0;
+    for (int fd : {out_fd_, err_fd_, exited ? -1 : pid_fd_}) {
+      if (fd >= 0) { fds[num_fds++] = pollfd{fd, POLLIN, 0}; }
+    }
+    if (::poll(fds, num_fds, timeout_ms) < 0 && errno != EINTR) {
+      PLOG(ERROR) << "poll() failed";
+      break;
+    }
+
+    Drain(out_fd_, result_.out, buffer.data());
+    Drain(err_fd_, result_.err, buffer.data());
+    if (!exited) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      reaped_ = ::waitpid(pid_, &status, WNOHANG) == pid_;
+      exited = reaped_;
+    }
+    if (has_deadline && Clock::now() >= deadline) {
+      // 子进程退出之后, 它启动的进程可能还持有管道, 超时之后也不再等待
+      if (!exited) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ::kill(pid_, SIGKILL);
+        while (::waitpid(pid_, &status, 0) < 0 && errno == EINTR) {}
+        reaped_ = true;
+        result_.timed_out = true;
+        exited = true;
+      }
+      break;
+    }
+  }
+  this->CloseFds();
+
+  if (WIFEXITED(status)) {
+    result_.exit_code = WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    result_.signal = WTERMSIG(status);
+  }
+  return std::move(result_);
+}
+
+void Subprocess::Kill(int signal) {
+  // 进程被回收之后pid可能被重用, 所以要与waitpid互斥
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pid_ > 0 && !reaped_) { ::kill(pid_, signal); }
+}
+
+SubprocessResult Subprocess::Run(std::vector<std::string> argv,
+                                 const Options& options) {
+  Subprocess process(std::move(argv), options);
+  if (!process.Start()) { return SubprocessResult(); }
+  return process.Wait();
+}
+
+std::vector<SubprocessResult> Subprocess::RunAll(
+    const std::vector<std::vector<std::string>>& commands, ThreadPool& pool,
+    const Options& options, int max_concurrency) {
+  std::vector<SubprocessResult> results(commands.size());
+  int64_t slots = max_concurrency > 0 ? max_concurrency : pool.size() + 1;
+  slots = std::min<int64_t>(slots, int64_t(commands.size()));
+  // 每个参与者占一个槽位, 依次领取命令运行, 所以同时运行的进程数不超过槽位数
+  std::atomic<size_t> next{0};
+  auto run = [&](int64_t) {
+    for (auto i = next.fetch_add(1); i < commands.size();
+         i = next.fetch_add(1)) {
+      results[i] = Run(commands[i], options);
+    }
+  };
+  ParallelFor(pool, 0, slots, run, 1);
+  return results;
+}
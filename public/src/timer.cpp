@@ -0,0 +1,200 @@
+#include "timer.h"
+
+using Seconds = std::chrono::seconds;
+
+static const int64_t kSecondsPerDay = 24 * 60 * 60;
+// 时区偏移的跳变最多几个小时, 离区间边界一天以内的本地时间可能对应
+// 两个或者零个系统时间, 交给date库处理
+static const Seconds kZoneMargin(kSecondsPerDay);
+
+// 当前时区在[begin, end)内的偏移量
+struct ZoneCache {
+  date::sys_seconds begin{Seconds(1)};
+  date::sys_seconds end{Seconds(0)};
+  Seconds offset{0};
+};
+
+// 上一次格式化的本地时间, text为"YYYY-MM-DD HH:MM:SS"
+struct FormatCache {
+  int64_t day = std::numeric_limits<int64_t>::min();
+  int64_t second = std::numeric_limits<int64_t>::min();
+  char text[19];
+};
+
+static int64_t FloorDiv(int64_t a, int64_t b) {
+  return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+// 1970-01-01以来的天数 <-> 公历日期, 参考:
+// http://howardhinnant.github.io/date_algorithms.html
+static int64_t DaysFromCivil(int64_t y, int m, int d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const int64_t yoe = y - era * 400;
+  const int64_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static void CivilFromDays(int64_t z, int64_t& y, int& m, int& d) {
+  z += 719468;
+  const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const int64_t doe = z - era * 146097;
+  const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const int64_t mp = (5 * doy + 2) / 153;
+  d = int(doy - (153 * mp + 2) / 5 + 1);
+  m = int(mp < 10 ? mp + 3 : mp - 9);
+  y = yoe + era * 400 + (m <= 2);
+}
+
+// 固定宽度的十进制数, 左边补0
+static void WriteDigits(char* buffer, int64_t value, int width) {
+  for (int i = width - 1; i >= 0; --i) {
+    buffer[i] = char('0' + value % 10);
+    value /= 10;
+  }
+}
+
+static bool ReadDigits(const char* buffer, int width, int64_t& value) {
+  value = 0;
+  for (int i = 0; i < width; ++i) {
+    auto digit = unsigned(buffer[i] - '0');
+    if (digit > 9) { return false; }
+    value = value * 10 + digit;
+  }
+  return true;
+}
+
+static ZoneCache& GetZoneCache() {
+  thread_local ZoneCache cache;
+  return cache;
+}
+
+// 系统时间对应的本地时间偏移, 只有超出缓存的区间时才查询时区
+static Seconds GetZoneOffset(date::sys_seconds time) {
+  auto& cache = GetZoneCache();
+  if (time < cache.begin || time >= cache.end) {
+    auto info = date::current_zone()->get_info(time);
+    cache.begin = info.begin;
+    cache.end = info.end;
+    cache.offset = info.offset;
+  }
+  return cache.offset;
+}
+
+// 本地时间 -> 系统时间, 离缓存区间的边界太近时返回false
+static bool LocalToSys(Seconds local, date::sys_seconds& time) {
+  const auto& cache = GetZoneCache();
+  time = date::sys_seconds(local - cache.offset);
+  return time - cache.begin >= kZoneMargin && cache.end - time > kZoneMargin;
+}
+
+//////////////////////////////// implementation ////////////////////////////////
+
+DateTime::DateTime(const std::string& content) {
+  if (Parse(content, *this)) { return; }
+  date::local_time<Duration> local_time;
+  std::stringstream ss(content);
+  date::from_stream(ss, "%Y-%m-%d %H:%M:%S", local_time);
+  // 时区的剥离与添加实际上是time_zone做的
+  value = date::current_zone()->to_sys(local_time);
+}
+
+std::string DateTime::string() const {
+  char buffer[kStringSize];
+  return std::string(buffer, this->Format(buffer));
+}
+
+size_t DateTime::Format(char* buffer) const {
+  auto since_epoch = value.time_since_epoch();
+  auto sec = std::chrono::floor<Seconds>(since_epoch);
+  auto local = (sec + GetZoneOffset(date::sys_seconds(sec))).count();
+
+  thread_local FormatCache cache;
+  if (local != cache.second) {
+    int64_t day = FloorDiv(local, kSecondsPerDay);
+    if (day != cache.day) {
+      int64_t year = 0;
+      int month = 0;
+      int mday = 0;
+      CivilFromDays(day, year, month, mday);
+      WriteDigits(cache.text, year, 4);
+      WriteDigits(cache.text + 5, month, 2);
+      WriteDigits(cache.text + 8, mday, 2);
+      cache.text[4] = cache.text[7] = '-';
+      cache.text[10] = ' ';
+      cache.day = day;
+    }
+    int64_t seconds_of_day = local - day * kSecondsPerDay;
+    WriteDigits(cache.text + 11, seconds_of_day / 3600, 2);
+    WriteDigits(cache.text + 14, seconds_of_day / 60 % 60, 2);
+    WriteDigits(cache.text + 17, seconds_of_day % 60, 2);
+    cache.text[13] = cache.text[16] = ':';
+    cache.second = local;
+  }
+  std::memcpy(buffer, cache.text, sizeof(cache.text));
+  if constexpr (kFractionDigits > 0) {
+    buffer[19] = '.';
+    WriteDigits(buffer + 20, (since_epoch - sec).count(), kFractionDigits);
+  }
+  return kStringSize;
+}
+
+std::string DateTime::FormatColumn(const std::vector<DateTime>& values,
+                                   char separator) {
+  std::string column(values.size() * (kStringSize + 1), separator);
+  char* buffer = &column[0];
+  for (const auto& value : values) {
+    buffer += value.Format(buffer) + 1;
+  }
+  return column;
+}
+
+bool DateTime::Parse(std::string_view content, DateTime& result) {
+  const char* p = content.data();
+  if (content.size() < 19 || p[4] != '-' || p[7] != '-' || p[10] != ' ' ||
+      p[13] != ':' || p[16] != ':') {
+    return false;
+  }
+  int64_t fields[6];
+  const int offsets[6] = {0, 5, 8, 11, 14, 17};
+  for (int i = 0; i < 6; ++i) {
+    if (!ReadDigits(p + offsets[i], i == 0 ? 4 : 2, fields[i])) {
+      return false;
+    }
+  }
+  const auto& [year, month, mday, hour, minute, second] = fields;
+  if (month < 1 || month > 12 || mday < 1 || mday > 31 || hour > 23 ||
+      minute > 59 || second > 59) {
+    return false;
+  }
+  int64_t day = DaysFromCivil(year, int(month), int(mday));
+  int64_t check_year = 0;
+  int check_month = 0;
+  int check_mday = 0;
+  CivilFromDays(day, check_year, check_month, check_mday);
+  if (check_month != month) { return false; }  // 比如02-30
+
+  Duration fraction(0);
+  int digits = int(content.size()) - 20;
+  if (content.size() > 19) {
+    int64_t ticks = 0;
+    if (p[19] != '.' || digits < 1 || digits > kFractionDigits ||
+        !ReadDigits(p + 20, digits, ticks)) {
+      return false;
+    }
+    for (int i = digits; i < kFractionDigits; ++i) { ticks *= 10; }
+    fraction = Duration(ticks);
+  }
+
+  Seconds local(day * kSecondsPerDay + hour * 3600 + minute * 60 + second);
+  date::sys_seconds time;
+  if (!LocalToSys(local, time)) {
+    date::local_seconds local_time(local);
+    time = date::current_zone()->to_sys(local_time);
+    GetZoneOffset(time);  // 刷新缓存, 附近的时间可以走快速路径
+  }
+  result.value = TimePoint(time.time_since_epoch()) + fraction;
+  return true;
+}
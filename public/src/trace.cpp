@@ -0,0 +1,174 @@
+#include "trace.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// 单生产者单消费者的环形缓冲区, 生产者是所属的线程, 消费者是flush的线程
+class Tracer::TraceBuffer {
+ public:
+  static constexpr size_t kCapacity = 1 << 16;
+
+  TraceBuffer()
+      : events_(new TraceEvent[kCapacity]), tid_(int(::syscall(SYS_gettid))) {}
+
+  void Push(const TraceEvent& event) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= kCapacity) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events_[head & (kCapacity - 1)] = event;
+    head_.store(head + 1, std::memory_order_release);
+  }
+  template <class F> void Drain(F callback) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_acquire);
+    for (; tail < head; ++tail) { callback(events_[tail & (kCapacity - 1)]); }
+    tail_.store(tail, std::memory_order_release);
+  }
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+  int64_t dropped() { return dropped_.exchange(0); }
+  int tid() const { return tid_; }
+
+ private:
+  std::unique_ptr<TraceEvent[]> events_;
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  std::atomic<int64_t> dropped_{0};
+  int tid_;
+};
+
+std::atomic<bool> Tracer::enabled_{false};
+
+//////////////////////////////// implementation ////////////////////////////////
+
+Tracer& Tracer::Instance() {
+  // 故意不析构, 避免其他静态对象析构时记录事件访问到已经析构的Tracer
+  static Tracer* tracer = new Tracer();
+  return *tracer;
+}
+
+Tracer::~Tracer() { this->Stop(); }
+
+Tracer::TraceBuffer& Tracer::CurrentBuffer() {
+  // 线程退出后缓冲区仍由buffers_持有, 直到其中的事件被取走
+  thread_local std::shared_ptr<TraceBuffer> buffer;
+  if (buffer == nullptr) {
+    buffer = std::make_shared<TraceBuffer>();
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.push_back(buffer);
+  }
+  return *buffer;
+}
+
+int Tracer::num_buffers() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return int(buffers_.size());
+}
+
+void Tracer::Record(const char* name, int64_t begin, int64_t duration) {
+  this->CurrentBuffer().Push(TraceEvent{name, begin, duration});
+}
+
+Json::Value Tracer::Collect() {
+  // 每个缓冲区同一时间只能有一个消费者
+  std::lock_guard<std::mutex> collect_lock(collect_mutex_);
+  static const int pid = ::getpid();
+  Json::Value events(Json::arrayValue);
+  {
+    // 拷贝一份再取事件, 不阻塞新线程注册. 拷贝必须在下面的清理之前销毁,
+    // 否则每个缓冲区的use_count都至少是2, 永远不会被释放.
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      buffers = buffers_;
+    }
+    for (const auto& buffer : buffers) {
+      buffer->Drain([&events, &buffer](const TraceEvent& event) {
+        Json::Value value;
+        value["name"] = event.name;
+        value["ph"] = "X";
+        value["ts"] = double(event.begin) / 1000.0;
+        value["dur"] = double(event.duration) / 1000.0;
+        value["pid"] = pid;
+        value["tid"] = buffer->tid();
+        events.append(value);
+      });
+      auto dropped = buffer->dropped();
+      if (dropped > 0) {
+        LOG(WARNING) << "trace buffer of thread " << buffer->tid()
+                     << " is full, " << dropped << " events dropped.";
+      }
+    }
+  }
+  // 已经退出的线程的缓冲区只剩buffers_持有, 取空之后就可以释放了
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto finished = [](const std::shared_ptr<TraceBuffer>& buffer) {
+    return buffer.use_count() == 1 && buffer->empty();
+  };
+  buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(), finished),
+                 buffers_.end());
+  return events;
+}
+
+bool Tracer::Start(const std::string& file,
+                   std::chrono::milliseconds interval) {
+  std::lock_guard<std::mutex> lock(flush_mutex_);
+  if (running_) {
+    LOG(ERROR) << "Tracer is already started, writing to " << file_;
+    return false;
+  }
+  // 使用json数组格式, 末尾的']'可以省略, 这样进程中途退出时文件也能打开
+  if (!WriteFile(file, std::string("[\n"))) {
+    LOG(ERROR) << "failed to start tracing, can not write: " << file;
+    return false;
+  }
+  file_ = file;
+  running_ = true;
+  enabled_.store(true);
+  flusher_ = std::thread([this, interval] { this->Run(interval); });
+  return true;
+}
+
+void Tracer::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    if (!running_) { return; }
+    enabled_.store(false);
+    running_ = false;
+  }
+  condition_.notify_all();
+  flusher_.join();
+  this->Flush();
+}
+
+void Tracer::Flush() {
+  std::lock_guard<std::mutex> lock(flush_mutex_);
+  if (file_.empty()) { return; }
+  auto events = this->Collect();
+  if (events.empty()) { return; }
+  std::ofstream outfile(file_, std::ios_base::app);
+  if (!outfile.is_open()) {
+    LOG(ERROR) << "failed to write to file: " << file_;
+    return;
+  }
+  for (const auto& event : events) {
+    outfile << DumpJsonValue(event) << ",\n";
+  }
+}
+
+void Tracer::Run(std::chrono::milliseconds interval) {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(flush_mutex_);
+      condition_.wait_for(lock, interval, [this] { return !running_; });
+      if (!running_) { return; }
+    }
+    this->Flush();
+  }
+}
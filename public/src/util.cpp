@@ -1,8 +1,13 @@
 #include "util.h"
 
-#include <openssl/md5.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "json_lines.h"
+#include "parallel.h"
+#include "subprocess.h"
 
 using UnitValuePair = std::pair<std::string, int64_t>;
 using UnitValueVec = std::vector<UnitValuePair>;
@@ -21,15 +26,20 @@ static int64_t ParseUnitString(std::string content, const UnitValueVec& map) {
   return -1;
 }
 
-static std::string DumpUnitString(int64_t value, const UnitValueVec& map) {
-  for (size_t i = 0; i < map.size() - 1; ++i) {
-    if (value >= map[i].second) {
-      auto amount = float(value) / float(map[i].second);
-      return (boost::format("%.2f %s") % amount % map[i].first).str();
-    }
-  }
-  auto amount = float(value) / float(map.back().second);
-  return (boost::format("%.2f %s") % amount % map.back().first).str();
+struct UnitName {
+  const char* name;
+  int64_t value;
+};
+
+// 按"%.2f %s"的格式追加, 使用第一个不大于value的单位, 都大于时使用最后一个
+template <size_t N>
+static void AppendUnitString(std::string& buffer, int64_t value,
+                             const UnitName (&units)[N]) {
+  size_t i = 0;
+  while (i + 1 < N && value < units[i].value) { ++i; }
+  AppendFixed(buffer, float(value) / float(units[i].value));
+  buffer.push_back(' ');
+  buffer.append(units[i].name);
 }
 
 //////////////////////////////// implementation ////////////////////////////////
@@ -42,6 +52,10 @@ void MakeDirsForFile(const std::string& path) {
 }
 
 std::string ReadFile(const std::string& file, bool is_binary) {
+  // /proc下的文件等大小为0, 不能通过mmap读取, 走下面的流式读取
+  MappedFile mapped(file);
+  if (!mapped.empty()) { return std::string(mapped.view()); }
+
   std::ios_base::openmode mode = std::ios_base::in;
   if (is_binary) { mode |= std::ios_base::binary; }
   std::ifstream infile(file.c_str(), mode);
@@ -50,6 +64,20 @@ std::string ReadFile(const std::string& file, bool is_binary) {
                      std::istreambuf_iterator<char>());
 }
 
+std::string_view ReadFile(const MappedFile& file) { return file.view(); }
+
+std::vector<std::string_view> ReadLines(const MappedFile& file) {
+  std::vector<std::string_view> lines;
+  auto content = file.view();
+  while (!content.empty()) {
+    auto pos = content.find('\n');
+    if (pos == std::string_view::npos) { pos = content.size(); }
+    lines.push_back(content.substr(0, pos));
+    content.remove_prefix(std::min(pos + 1, content.size()));
+  }
+  return lines;
+}
+
 bool WriteFile(const std::string& file, const char* data, int length) {
   MakeDirsForFile(file);
   std::ofstream outfile(file, std::ios_base::binary);
@@ -71,22 +99,19 @@ Json::Value ParseJsonString(const std::string& content) {
   if (content.empty()) { return root; }
 
   std::string error;
-  Json::CharReaderBuilder builder;
-  Json::CharReader* reader = builder.newCharReader();
   const char* begin = content.data();
   const char* end = begin + content.length();
-  if (!reader->parse(begin, end, &root, &error)) {
+  if (!ThreadLocalJsonReader().parse(begin, end, &root, &error)) {
     LOG(ERROR) << "failed to parse json string, error: " << error;
     root = Json::Value();
   }
-  delete reader;
   return root;
 }
 
 std::string DumpJsonValue(const Json::Value& content) {
-  Json::StreamWriterBuilder builder;
-  builder["indentation"] = "";
-  return Json::writeString(builder, content);
+  std::ostringstream stream;
+  ThreadLocalJsonWriter().write(content, &stream);
+  return stream.str();
 }
 
 Json::Value ReadJsonFile(const std::string& json_file) {
@@ -109,38 +134,117 @@ void WriteJsonFile(const Json::Value& root, const std::string& json_file) {
 }
 
 std::string ExecShell(const std::string& cmd) {
-  std::string result;
-  std::array<char, 128> buffer = {};
-  FILE* pipe = popen(cmd.c_str(), "r");
-  if (pipe == nullptr) {
-    LOG(ERROR) << "popen() failed! " << strerror(errno);
-    return std::string();
-  }
-  while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-    result += buffer.data();
+  // 与popen一样, stdin和stderr都继承当前进程的, 只捕获stdout
+  Subprocess::Options options;
+  options.capture_stderr = false;
+  options.inherit_stdin = true;
+  return Subprocess::Run({"/bin/sh", "-c", cmd}, options).out;
+}
+
+// 与原来基于boost::filesystem::directory_iterator的实现一样, 失败时抛出异常
+static std::vector<DirEntry> ListEntriesOrThrow(const std::string& dirname,
+                                                const NameFilter& filter) {
+  std::vector<DirEntry> entries;
+  if (!ListEntries(dirname, entries, filter)) {
+    boost::system::error_code error(errno, boost::system::system_category());
+    throw boost::filesystem::filesystem_error("ListDirectory", dirname, error);
   }
-  pclose(pipe);
-  return result;
+  return entries;
 }
 
 std::vector<std::string> ListDirectory(const std::string& dirname,
                                        const std::regex& pattern) {
-  namespace bf = boost::filesystem;
+  auto entries = ListEntriesOrThrow(dirname, NameFilter());
   std::vector<std::string> names;
-  for (const auto& entry : bf::directory_iterator(dirname)) {
-    auto path = entry.path().filename().string();
-    if (std::regex_match(path, pattern)) { names.push_back(path); }
+  for (auto& entry : entries) {
+    if (std::regex_match(entry.name, pattern)) {
+      names.push_back(std::move(entry.name));
+    }
   }
   std::sort(names.begin(), names.end());
   return names;
 }
 
+std::vector<std::string> ListDirectory(const std::string& dirname,
+                                       const NameFilter& filter) {
+  auto entries = ListEntriesOrThrow(dirname, filter);
+  std::vector<std::string> names;
+  names.reserve(entries.size());
+  for (auto& entry : entries) { names.push_back(std::move(entry.name)); }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
 std::string CalcMD5(const std::string& content) {
-  std::array<unsigned char, MD5_DIGEST_LENGTH> md5 = {};
-  MD5((unsigned char*) content.data(), content.size(), md5.data());
-  std::string result;
-  for (const auto& c : md5) {
-    result += (boost::format("%02x") % int(c)).str();
+  MD5Hasher hasher;
+  hasher.Update(content);
+  return hasher.Finish();
+}
+
+MD5Hasher::MD5Hasher() : context_(EVP_MD_CTX_new()) {
+  CHECK(context_ != nullptr) << "failed to create md5 context.";
+  CHECK(EVP_DigestInit_ex(context_, EVP_md5(), nullptr));
+}
+
+MD5Hasher::~MD5Hasher() { EVP_MD_CTX_free(context_); }
+
+void MD5Hasher::Update(const void* data, size_t size) {
+  CHECK(EVP_DigestUpdate(context_, data, size));
+}
+
+std::string MD5Hasher::Finish() {
+  std::array<unsigned char, EVP_MAX_MD_SIZE> md5 = {};
+  unsigned int length = 0;
+  CHECK(EVP_DigestFinal_ex(context_, md5.data(), &length));
+  CHECK(EVP_DigestInit_ex(context_, EVP_md5(), nullptr));
+  return GetHexString(md5.data(), length);
+}
+
+std::string CalcFileMD5(const std::string& file) {
+  MD5Hasher hasher;
+  MappedFile mapped(file, MappedFile::Advice::kSequential);
+  if (!mapped.empty()) {
+    hasher.Update(mapped.view());
+    return hasher.Finish();
+  }
+
+  // 大小为0的特殊文件(比如/proc下的文件)无法映射, 分块读取
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) { return std::string(); }
+  const size_t buffer_size = 1 << 20;
+  std::unique_ptr<char[]> buffer(new char[buffer_size]);
+  ssize_t length = 0;
+  while ((length = ::read(fd, buffer.get(), buffer_size)) != 0) {
+    if (length < 0 && errno == EINTR) { continue; }
+    if (length < 0) {
+      LOG(ERROR) << "failed to read " << file << ": " << strerror(errno);
+      ::close(fd);
+      return std::string();
+    }
+    hasher.Update(buffer.get(), length);
+  }
+  ::close(fd);
+  return hasher.Finish();
+}
+
+std::vector<std::string> CalcFileMD5(const std::vector<std::string>& files,
+                                     ThreadPool& pool) {
+  // ParallelFor在等待时自己也处理文件, 在pool的worker中调用也不会死锁
+  std::vector<std::string> results(files.size());
+  auto calculate = [&files, &results](int64_t i) {
+    results[i] = CalcFileMD5(files[i]);
+  };
+  ParallelFor(pool, 0, int64_t(files.size()), calculate, 1);
+  return results;
+}
+
+std::string GetHexString(const void* data, size_t size) {
+  static const char digits[] = "0123456789abcdef";
+  const auto* bytes = static_cast<const unsigned char*>(data);
+  std::string result(size * 2, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    result[2 * i] = digits[bytes[i] >> 4];
+    result[2 * i + 1] = digits[bytes[i] & 0x0F];
   }
   return result;
 }
@@ -158,24 +262,11 @@ int64_t GetAvailableSpace(const std::string& path) {
 }
 
 int64_t GetFileSize(const std::string& path) {
-  // linux系统中, 一个文件夹占4096个字节
-  const int64_t empty_dir_size = 4096;
-  namespace bf = boost::filesystem;
-  if (!bf::exists(path)) { return -1; }
-  if (bf::is_regular_file(path)) { return bf::file_size(path); }
-  if (bf::is_directory(path)) {
-    int64_t total = empty_dir_size;
-    using Iterator = bf::recursive_directory_iterator;
-    for (Iterator iter(path); iter != Iterator{}; ++iter) {
-      if (bf::is_regular_file(iter->path())) {
-        total += bf::file_size(iter->path());
-      } else if (bf::is_directory(iter->path())) {
-        total += empty_dir_size;
-      }
-    }
-    return total;
-  }
-  return -1;
+  return DiskUsage().GetSize(path);
+}
+
+int64_t GetFileSize(const std::string& path, ThreadPool& pool) {
+  return DiskUsage(&pool).GetSize(path);
 }
 
 int64_t GetBytesByString(std::string content) {
@@ -193,14 +284,20 @@ int64_t GetBytesByString(std::string content) {
 }
 
 std::string GetBytesString(int64_t bytes) {
-  const UnitValueVec map = {
+  std::string result;
+  AppendBytesString(result, bytes);
+  return result;
+}
+
+void AppendBytesString(std::string& buffer, int64_t bytes) {
+  static const UnitName units[] = {
     // 算法匹配最前面的pair, 所以这里顺序很重要
     {"GB", 1024*1024*1024},
     {"MB", 1024*1024},
     {"KB", 1024},
     {"B", 1},
   };  // NOFORMAT(-6:)
-  return DumpUnitString(bytes, map);
+  AppendUnitString(buffer, bytes, units);
 }
 
 int64_t GetSecondsByString(std::string content) {
@@ -214,12 +311,18 @@ int64_t GetSecondsByString(std::string content) {
 }
 
 std::string GetSecondsString(int64_t seconds) {
-  const UnitValueVec map =  {
+  std::string result;
+  AppendSecondsString(result, seconds);
+  return result;
+}
+
+void AppendSecondsString(std::string& buffer, int64_t seconds) {
+  static const UnitName units[] = {
     // 算法匹配最前面的pair, 所以这里顺序很重要
     {"day",  24*60*60},
     {"hour", 60*60},
     {"min",  60},
     {"sec",  1}
   };  // NOFORMAT(-6:)
-  return DumpUnitString(seconds, map);
+  AppendUnitString(buffer, seconds, units);
 }
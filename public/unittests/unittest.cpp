@@ -1,9 +1,19 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include "async_file.h"
+#include "blocking_queue.h"
 #include "common.h"
+#include "cpu_topology.h"
+#include "file_writer.h"
+#include "json_lines.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "ring_queue.h"
+#include "subprocess.h"
 #include "thread_pool.h"
 #include "timer.h"
+#include "trace.h"
 #include "util.h"
 
 // NOLINTFIELD(cppcoreguidelines-avoid-non-const-global-variables)
@@ -20,12 +30,582 @@ TEST(FileIOTest, fileio) {
   }
 }
 
+TEST(FileIOTest, mapped) {
+  auto tempfile = boost::filesystem::unique_path().string();
+  std::vector<std::string> lines = {"1 2", "3"};
+  EXPECT_TRUE(WriteFile(tempfile, lines));
+  MappedFile mapped(tempfile);
+  EXPECT_TRUE(mapped.is_open());
+  EXPECT_EQ(ReadFile(mapped), "1 2\n3\n");
+  auto views = ReadLines(mapped);
+  EXPECT_EQ(views.size(), 2);
+  EXPECT_EQ(views[0], "1 2");
+  EXPECT_EQ(ReadLines<int>(mapped), std::vector<int>({1, 2, 3}));
+  MappedFile moved(std::move(mapped));
+  EXPECT_FALSE(mapped.is_open());
+  EXPECT_EQ(moved.size(), 6);
+  EXPECT_FALSE(MappedFile("/nonexistent/file").is_open());
+  if (boost::filesystem::exists(tempfile)) {
+    boost::filesystem::remove(tempfile);
+  }
+}
+
+TEST(FileIOTest, parallel_lines) {
+  auto tempfile = boost::filesystem::unique_path().string();
+  std::vector<std::string> lines;
+  for (int i = 0; i < 1000; ++i) { lines.push_back(std::to_string(i * 0.5)); }
+  EXPECT_TRUE(WriteFile(tempfile, lines));
+  ThreadPool pool(4);
+  auto expected = ReadLines<double>(tempfile);
+  EXPECT_EQ(expected.size(), 1000);
+  EXPECT_EQ(ReadLines<double>(tempfile, pool, 64), expected);
+  EXPECT_EQ(ReadLines<std::string>(tempfile, pool, 64), lines);
+  int num_batches = 0;
+  auto count = [&num_batches](std::vector<double>&) { ++num_batches; };
+  EXPECT_TRUE(ReadLinesInBatches<double>(tempfile, pool, count, 1024));
+  EXPECT_GT(num_batches, 1);
+  // 与串行版本一样, 遇到无法解析的内容时停止
+  for (int i = 0; i < 1000; ++i) { lines[i] = std::to_string(i); }
+  lines[500] = "bad";
+  EXPECT_TRUE(WriteFile(tempfile, lines));
+  EXPECT_EQ(ReadLines<int>(tempfile, pool, 64).size(), 500);
+  EXPECT_EQ(ReadLines<int>(tempfile, pool, 64), ReadLines<int>(tempfile));
+  if (boost::filesystem::exists(tempfile)) {
+    boost::filesystem::remove(tempfile);
+  }
+}
+
+TEST(FileIOTest, disk_usage) {
+  namespace bf = boost::filesystem;
+  auto tempdir = bf::unique_path().string();
+  EXPECT_TRUE(WriteFile(tempdir + "/a/b/one", std::string(100, 'x')));
+  EXPECT_TRUE(WriteFile(tempdir + "/a/two", std::string(20, 'x')));
+  EXPECT_TRUE(WriteFile(tempdir + "/c/three", std::string(3, 'x')));
+  EXPECT_EQ(GetFileSize(tempdir + "/a/two"), 20);
+  EXPECT_EQ(GetFileSize(tempdir), 4 * 4096 + 123);
+  ThreadPool pool(4);
+  EXPECT_EQ(GetFileSize(tempdir, pool), 4 * 4096 + 123);
+  EXPECT_EQ(GetFileSize(tempdir + "/nonexistent"), -1);
+
+  // 刚刚修改过的目录不会被缓存
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  DiskUsage usage(&pool, true);
+  EXPECT_EQ(usage.GetSize(tempdir), 4 * 4096 + 123);
+  EXPECT_EQ(usage.num_cached(), 4);
+  EXPECT_TRUE(WriteFile(tempdir + "/a/b/four", std::string(4000, 'x')));
+  EXPECT_EQ(usage.GetSize(tempdir), 4 * 4096 + 4123);
+  bf::remove_all(tempdir + "/c");
+  EXPECT_EQ(usage.GetSize(tempdir), 3 * 4096 + 4120);
+  // 被删除的目录从缓存中清除
+  EXPECT_EQ(usage.num_cached(), 3);
+  // 原地修改文件不改变目录的mtime, 需要ClearCache之后才能统计到
+  EXPECT_TRUE(WriteFile(tempdir + "/a/two", std::string(30, 'x')));
+  EXPECT_EQ(usage.GetSize(tempdir), 3 * 4096 + 4120);
+  usage.ClearCache();
+  EXPECT_EQ(usage.GetSize(tempdir), 3 * 4096 + 4130);
+  bf::remove_all(tempdir);
+}
+
+TEST(FileIOTest, async) {
+  auto dirname = boost::filesystem::unique_path().string();
+  using Backend = AsyncFileIO::Backend;
+  for (auto backend : {Backend::kAuto, Backend::kThreadPool}) {
+    AsyncFileIO io(backend, 8);
+    std::vector<std::string> files;
+    std::vector<std::string> contents;
+    for (int i = 0; i < 50; ++i) {
+      files.push_back(dirname + "/sub/" + std::to_string(i) + ".txt");
+      contents.push_back(std::string(i * 5000, char('a' + i % 26)));
+    }
+    EXPECT_TRUE(io.WriteFiles(files, contents));
+    EXPECT_EQ(io.ReadFiles(files), contents);
+
+    EXPECT_TRUE(io.AsyncWriteFile(files[0], "hello").get());
+    EXPECT_EQ(io.AsyncReadFile(files[0]).get(), "hello");
+    EXPECT_EQ(io.AsyncReadFile(dirname + "/missing").get(), "");
+    // /proc下的文件大小为0, 需要读到文件尾
+    EXPECT_FALSE(io.AsyncReadFile("/proc/self/status").get().empty());
+
+    std::atomic<int> succeeded{0};
+    for (const auto& file : files) {
+      io.AsyncReadFile(file, [&succeeded](bool ok, std::string&) {
+        if (ok) { ++succeeded; }
+      });  // NOFORMAT(-2:)
+    }
+    io.Wait();
+    EXPECT_EQ(succeeded.load(), 50);
+  }
+  boost::filesystem::remove_all(dirname);
+}
+
+TEST(FileIOTest, writer) {
+  auto dirname = boost::filesystem::unique_path().string();
+  using Durability = FileWriter::Durability;
+  for (auto durability :
+       {Durability::kNone, Durability::kAtomic, Durability::kDurable}) {
+    std::vector<std::future<bool>> results;
+    {
+      FileWriter writer(durability);
+      for (int i = 0; i < 100; ++i) {
+        auto file = dirname + "/" + std::to_string(i % 4) + "/" +
+                    std::to_string(i) + ".txt";
+        results.push_back(writer.Write(file, std::to_string(i)));
+      }
+      // 同一个文件写两次, 以后提交的为准
+      writer.Write(dirname + "/0/0.txt", "first");
+      results.push_back(writer.Write(dirname + "/0/0.txt", "second"));
+      // 一组中多次写同一个文件, kNone也不能并发写而互相截断
+      for (int k = 0; k < 20; ++k) {
+        std::string content(1000 * (20 - k), char('a' + k));
+        results.push_back(writer.Write(dirname + "/same.txt", content));
+      }
+      Json::Value root;
+      root["key"] = "value";
+      results.push_back(writer.WriteJson(root, dirname + "/root.json"));
+      writer.Flush();
+      EXPECT_EQ(writer.num_files(), 123);
+      EXPECT_GE(writer.num_batches(), 1);
+    }
+    for (auto& result : results) { EXPECT_TRUE(result.get()); }
+    EXPECT_EQ(ReadFile(dirname + "/3/99.txt"), "99");
+    EXPECT_EQ(ReadFile(dirname + "/0/0.txt"), "second");
+    EXPECT_EQ(ReadFile(dirname + "/same.txt"), std::string(1000, 't'));
+    EXPECT_EQ(ReadJsonFile(dirname + "/root.json")["key"].asString(), "value");
+    // 没有残留的临时文件
+    int num_files = 0;
+    boost::filesystem::recursive_directory_iterator it(dirname), end;
+    for (; it != end; ++it) {
+      if (boost::filesystem::is_regular_file(it->path())) { ++num_files; }
+    }
+    EXPECT_EQ(num_files, 102);
+    boost::filesystem::remove_all(dirname);
+  }
+
+  // 通过临时文件替换时保留原文件的权限
+  namespace bf = boost::filesystem;
+  auto file = dirname + "/private.txt";
+  EXPECT_TRUE(WriteFile(file, "old"));
+  bf::permissions(file, bf::owner_read | bf::owner_write);
+  std::future<bool> result;
+  {
+    FileWriter writer(Durability::kAtomic);
+    result = writer.Write(file, "new");
+  }
+  EXPECT_TRUE(result.get());
+  EXPECT_EQ(ReadFile(file), "new");
+  EXPECT_EQ(bf::status(file).permissions(), bf::owner_read | bf::owner_write);
+  bf::remove_all(dirname);
+}
+
+TEST(FileIOTest, directory) {
+  EXPECT_TRUE(GlobMatch("*.json", "a.json"));
+  EXPECT_FALSE(GlobMatch("*.json", "a.json.tmp"));
+  EXPECT_TRUE(GlobMatch("log-?\?-[0-9]*.txt", "log-ab-7z.txt"));
+  EXPECT_FALSE(GlobMatch("log-[!0-9]*", "log-1"));
+  EXPECT_TRUE(GlobMatch("a*b*c", "aXXbYYbc"));
+  EXPECT_TRUE(GlobMatch("\\*[]]", "*]"));
+  EXPECT_TRUE(GlobMatch("[", "["));
+
+  auto dirname = boost::filesystem::unique_path().string();
+  for (auto name : {"a.json", "b.json", "c.txt", "sub/d.json"}) {
+    EXPECT_TRUE(WriteFile(dirname + "/" + name, "{}"));
+  }
+  std::vector<DirEntry> entries;
+  EXPECT_TRUE(ListEntries(dirname, entries));
+  EXPECT_EQ(entries.size(), 4);
+  for (const auto& entry : entries) {
+    auto type = entry.name == "sub" ? DirEntry::Type::kDirectory
+                                    : DirEntry::Type::kFile;
+    EXPECT_EQ(entry.type, type);
+  }
+  EXPECT_FALSE(ListEntries(dirname + "/missing", entries));
+  std::vector<std::string> expected = {"a.json", "b.json"};
+  EXPECT_EQ(ListDirectory(dirname, NameFilter{"", ".json", ""}), expected);
+  EXPECT_EQ(ListDirectory(dirname, std::regex(".*\\.json")), expected);
+  EXPECT_THROW(ListDirectory(dirname + "/missing"),
+               boost::filesystem::filesystem_error);
+
+  DirectoryIndex index(dirname, NameFilter{"", "", "*.json"});
+  ASSERT_TRUE(index.is_valid());
+  EXPECT_EQ(index.List(), expected);
+  WriteFile(dirname + "/e.json", "{}");
+  WriteFile(dirname + "/f.txt", "");
+  boost::filesystem::rename(dirname + "/a.json", dirname + "/g.json");
+  boost::filesystem::remove(dirname + "/b.json");
+  std::vector<std::string> added;
+  std::vector<std::string> removed;
+  EXPECT_TRUE(index.Update(&added, &removed));
+  EXPECT_EQ(added, std::vector<std::string>({"e.json", "g.json"}));
+  EXPECT_EQ(removed, std::vector<std::string>({"a.json", "b.json"}));
+  EXPECT_EQ(index.List(), ListDirectory(dirname, NameFilter{"", ".json", ""}));
+
+  boost::filesystem::remove_all(dirname);
+  EXPECT_FALSE(index.Update());
+  EXPECT_TRUE(index.entries().empty());
+}
+
 TEST(ThreadPoolTest, pool) {
   ThreadPool pool(4);
   auto result = pool.enqueue([](int answer) { return answer; }, 42);
   EXPECT_EQ(result.get(), 42);
 }
 
+TEST(ThreadPoolTest, metrics) {
+  ThreadPool pool(2);
+  std::vector<std::future<void>> results;
+  for (int i = 0; i < 10; ++i) {
+    results.push_back(pool.enqueue(
+        [] { std::this_thread::sleep_for(std::chrono::milliseconds(2)); }));
+  }
+  for (auto& result : results) { result.get(); }
+  // future就绪时任务的统计可能还没有写完
+  auto metrics = pool.GetMetrics();
+  for (int i = 0; i < 100 && metrics["run_time"]["count"] != 10; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    metrics = pool.GetMetrics();
+  }
+  EXPECT_EQ(metrics["enqueued"].asInt64(), 10);
+  EXPECT_EQ(metrics["queue_depth"].asInt64(), 0);
+  EXPECT_GE(metrics["peak_queue_depth"].asInt64(), 1);
+  EXPECT_EQ(metrics["run_time"]["count"].asInt64(), 10);
+  EXPECT_GE(metrics["run_time"]["p50_us"].asDouble(), 1000.0);
+  EXPECT_EQ(metrics["workers"].size(), 2);
+  int64_t tasks = 0;
+  for (const auto& worker : metrics["workers"]) {
+    tasks += worker["tasks"].asInt64();
+    EXPECT_LE(worker["utilization"].asDouble(), 1.0);
+  }
+  EXPECT_EQ(tasks, 10);
+}
+
+TEST(ThreadPoolTest, priority) {
+  using Mode = ThreadPool::Mode;
+  for (auto mode : {Mode::kShared, Mode::kWorkStealing}) {
+    ThreadPool pool(1, mode);
+    // 先用一个任务占住唯一的worker, 使后面的任务都在排队
+    std::promise<void> gate;
+    auto blocker = pool.enqueue([&gate] { gate.get_future().wait(); });
+    std::mutex mutex;
+    std::vector<int> order;
+    auto record = [&mutex, &order](int value) {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(value);
+    };
+    std::vector<std::future<void>> results;
+    results.push_back(pool.enqueue_with_priority(-1000, record, 3));
+    results.push_back(pool.enqueue_with_priority(0, record, 1));
+    results.push_back(pool.enqueue_with_priority(5, record, 0));
+    results.push_back(pool.enqueue_with_priority(0, record, 2));
+    gate.set_value();
+    for (auto& result : results) { result.get(); }
+    EXPECT_EQ(order, std::vector<int>({0, 1, 2, 3}));
+  }
+
+  for (auto mode : {Mode::kShared, Mode::kWorkStealing}) {
+    ThreadPool pool(1, mode);
+    pool.set_drop_expired(true);
+    pool.set_deadline_slack(std::chrono::seconds(30));
+    std::promise<void> gate;
+    auto blocker = pool.enqueue([&gate] { gate.get_future().wait(); });
+    // 排在大量普通任务之后的截止任务, 在截止之前就被优先执行
+    std::atomic<int> bulk_done{0};
+    for (int i = 0; i < 100; ++i) {
+      pool.post([&bulk_done] { ++bulk_done; });
+    }
+    auto done = [&bulk_done] { return bulk_done.load(); };
+    auto now = std::chrono::steady_clock::now();
+    auto late =
+        pool.enqueue_with_deadline(now + std::chrono::seconds(10), done);
+    auto early = pool.enqueue_with_deadline(now + std::chrono::seconds(5),
+                                            [] { return -1; });
+    auto expired = pool.enqueue_with_deadline(now, [] { return 0; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    gate.set_value();
+    EXPECT_EQ(early.get(), -1);
+    EXPECT_EQ(late.get(), 0);
+    EXPECT_THROW(expired.get(), std::future_error);
+    EXPECT_EQ(pool.GetMetrics()["dropped"].asInt64(), 1);
+  }
+}
+
+TEST(ThreadPoolTest, work_stealing) {
+  ThreadPool pool(4, ThreadPool::Mode::kWorkStealing);
+  std::atomic<int> counter{0};
+  auto spawn = [&pool, &counter](int fanout) {
+    std::vector<std::future<void>> children;
+    for (int i = 0; i < fanout; ++i) {
+      children.push_back(pool.enqueue([&counter] { counter += 1; }));
+    }
+    return children;
+  };
+  std::vector<std::future<std::vector<std::future<void>>>> parents;
+  for (int i = 0; i < 100; ++i) { parents.push_back(pool.enqueue(spawn, 10)); }
+  for (auto& parent : parents) {
+    for (auto& child : parent.get()) { child.get(); }
+  }
+  EXPECT_EQ(counter.load(), 1000);
+  auto result = pool.enqueue([](int answer) { return answer; }, 42);
+  EXPECT_EQ(result.get(), 42);
+}
+
+TEST(ThreadPoolTest, post) {
+  // 大对象放在BlockPool中, 只能移动的对象也可以保存
+  std::array<int64_t, 32> large{};
+  large[31] = 7;
+  auto owned = std::make_unique<int>(5);
+  InlineTask task([large, owned = std::move(owned)] {
+    EXPECT_EQ(large[31] + *owned, 12);
+  });  // NOFORMAT(-2:)
+  InlineTask moved(std::move(task));
+  EXPECT_FALSE(task);
+  ASSERT_TRUE(moved);
+  moved();
+
+  using Mode = ThreadPool::Mode;
+  for (auto mode : {Mode::kShared, Mode::kWorkStealing}) {
+    std::atomic<int> sum{0};
+    {
+      ThreadPool pool(4, mode);
+      for (int i = 1; i <= 100; ++i) {
+        pool.post([&sum](int value) { sum += value; }, i);
+      }
+      pool.post([] { throw std::runtime_error("ignored"); });
+      auto value = std::make_unique<int>(42);
+      auto result =
+          pool.enqueue([value = std::move(value)] { return *value; });
+      EXPECT_EQ(result.get(), 42);
+    }
+    EXPECT_EQ(sum.load(), 5050);
+  }
+}
+
+TEST(ThreadPoolTest, affinity) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0-3,8,10-11\n", cpus));
+  EXPECT_EQ(cpus, std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(FormatCpuList(cpus), "0-3,8,10-11");
+  EXPECT_FALSE(ParseCpuList("3-1", cpus));
+  EXPECT_FALSE(ParseCpuList("0;1", cpus));
+
+  // 两个节点的sysfs, 节点1的cpu 7不在允许的范围内
+  auto dirname = boost::filesystem::unique_path().string();
+  EXPECT_TRUE(WriteFile(dirname + "/node0/cpulist", "0-1,4\n"));
+  EXPECT_TRUE(WriteFile(dirname + "/node1/cpulist", "2-3,7\n"));
+  EXPECT_TRUE(WriteFile(dirname + "/online", "0-1\n"));
+  auto topology = CpuTopology::Load(dirname, {0, 1, 2, 3, 4, 5});
+  boost::filesystem::remove_all(dirname);
+  ASSERT_EQ(topology.nodes.size(), 2);
+  EXPECT_EQ(topology.nodes[0].cpus, std::vector<int>({0, 1, 4, 5}));
+  EXPECT_EQ(topology.nodes[1].id, 1);
+  EXPECT_EQ(topology.cpus, std::vector<int>({0, 1, 2, 3, 4, 5}));
+  EXPECT_EQ(topology.NodeIndexOf(3), 1);
+  EXPECT_EQ(topology.NodeIndexOf(7), -1);
+  EXPECT_EQ(OrderCpus(topology, CpuAffinity::kScatter),
+            std::vector<int>({0, 2, 1, 3, 4, 5}));
+  EXPECT_EQ(OrderCpus(topology, CpuAffinity::kCompact),
+            std::vector<int>({0, 1, 4, 5, 2, 3}));
+
+  // worker绑定到当前允许的第一个cpu上, 线程名带序号
+  const auto& system = CpuTopology::Get();
+  ASSERT_FALSE(system.nodes.empty());
+  ThreadPoolOptions options;
+  options.name = "pinned";
+  options.cpus = {system.cpus.front()};
+  ThreadPool pool(2, ThreadPool::Mode::kShared, options);
+  auto affinity = pool.enqueue([] { return GetThreadAffinity(); });
+  EXPECT_EQ(affinity.get(), options.cpus);
+  auto name = pool.enqueue([] {
+    char buffer[16] = {};
+    pthread_getname_np(pthread_self(), buffer, sizeof(buffer));
+    return std::string(buffer);
+  });
+  EXPECT_EQ(name.get().substr(0, 7), "pinned-");
+  auto metrics = pool.GetMetrics();
+  EXPECT_EQ(metrics["workers"][1]["cpus"].asString(),
+            std::to_string(system.cpus.front()));
+
+  NumaThreadPool pools(1);
+  EXPECT_EQ(pools.size(), int(system.nodes.size()));
+  auto local = pools.pool(0).enqueue([&pools] { return &pools.local(); });
+  EXPECT_EQ(local.get(), &pools.pool(0));
+  EXPECT_EQ(pools.GetMetrics()["nodes"].size(), system.nodes.size());
+}
+
+TEST(ParallelTest, parallel) {
+  ThreadPool pool(4);
+  std::vector<int> values(10000, 0);
+  ParallelFor(pool, 0, values.size(), [&values](int64_t i) { values[i] = i; });
+  auto square = [](int64_t i) { return i * i; };
+  auto sum = ParallelReduce(pool, 0, values.size(), int64_t(0), square,
+                            std::plus<int64_t>());
+  EXPECT_EQ(sum, int64_t(9999) * 10000 * 19999 / 6);
+  std::vector<int> doubled(values.size());
+  auto twice = [](int value) { return value * 2; };
+  ParallelTransform(pool, values.begin(), values.end(), doubled.begin(), twice);
+  EXPECT_EQ(doubled[1234], 2468);
+  // 在worker内部调用时, 调用线程自己也能完成全部工作
+  auto nested = pool.enqueue([&pool] {
+    return ParallelReduce(pool, 0, 100, 0, [](int64_t) { return 1; },
+                          std::plus<int>(), 1);
+  });
+  EXPECT_EQ(nested.get(), 100);
+  auto fail = [](int64_t) { throw std::runtime_error("fail"); };
+  EXPECT_THROW(ParallelFor(pool, 0, 100, fail), std::runtime_error);
+}
+
+TEST(PipelineTest, pipeline) {
+  // 并行且保序的变换 + 过滤 + 凑批, 最终顺序与输入相同
+  std::vector<int> output;
+  Pipeline<int> pipeline;
+  PipelineStageOptions square{"square", 4, 8, true};
+  PipelineStageOptions batch{"batch", 2, 16, true, 10};
+  batch.batch_timeout = std::chrono::milliseconds(5);
+  auto odd = [](int&& v) -> std::optional<int> {
+    if (v % 2 == 0) { return std::nullopt; }
+    return v;
+  };
+  pipeline.Then([](int&& v) { return v * v; }, square)
+      .Then(odd, {"odd", 3, 8, true})
+      .ThenBatch([](std::vector<int>&& values) { return std::move(values); },
+                 batch)
+      .Sink([&output](int&& v) { output.push_back(v); }, {"sink"});
+  pipeline.Start();
+  for (int i = 0; i < 1000; ++i) { EXPECT_TRUE(pipeline.Push(i)); }
+  pipeline.Close();
+  pipeline.Wait();
+  EXPECT_FALSE(pipeline.Push(1000));
+  ASSERT_EQ(output.size(), 500);
+  for (int i = 0; i < 500; ++i) {
+    EXPECT_EQ(output[i], (2 * i + 1) * (2 * i + 1));
+  }
+  auto metrics = pipeline.GetMetrics();
+  EXPECT_EQ(metrics["stages"].size(), 4);
+  EXPECT_EQ(metrics["stages"][0]["processed"].asInt64(), 1000);
+  EXPECT_EQ(metrics["stages"][1]["emitted"].asInt64(), 500);
+  EXPECT_EQ(metrics["stages"][3]["name"].asString(), "sink");
+  EXPECT_FALSE(metrics["bottleneck"].asString().empty());
+
+  // ordered时最前面的一批卡住, 其他worker最多再处理queue_capacity个
+  Pipeline<int> stalled;
+  std::atomic<bool> stalling{false};
+  std::atomic<int> overtaken{0};
+  auto slow_head = [&stalling, &overtaken](int&& v) {
+    if (v == 0) {
+      stalling = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      stalling = false;
+    } else if (stalling) {
+      ++overtaken;
+    }
+    return v;
+  };
+  std::vector<int> stalled_output;
+  stalled.Then(slow_head, {"slow_head", 4, 8, true})
+      .Sink([&stalled_output](int&& v) { stalled_output.push_back(v); });
+  stalled.Start();
+  for (int i = 0; i < 200; ++i) { EXPECT_TRUE(stalled.Push(i)); }
+  stalled.Close();
+  stalled.Wait();
+  EXPECT_EQ(stalled_output.size(), 200);
+  EXPECT_TRUE(std::is_sorted(stalled_output.begin(), stalled_output.end()));
+  EXPECT_LT(overtaken.load(), 8);
+
+  // 异常取消整个流水线, 阻塞的Push返回false, Wait重新抛出异常
+  Pipeline<int> failing;
+  failing
+      .Then([](int&& v) {
+        if (v == 10) { throw std::runtime_error("fail"); }
+        return v;
+      })
+      .SinkBatch([](std::vector<int>&&) {}, {"", 1, 4});
+  failing.Start();
+  int pushed = 0;
+  while (pushed < 100000 && failing.Push(pushed)) { ++pushed; }
+  EXPECT_LT(pushed, 100000);
+  EXPECT_THROW(failing.Wait(), std::runtime_error);
+
+  // 下游阻塞时Cancel不会等待剩余的数据
+  Pipeline<int> cancelled;
+  std::atomic<int> sunk{0};
+  cancelled.Sink([&sunk](int&&) {
+    ++sunk;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }, {"slow", 1, 4});
+  cancelled.Start();
+  std::thread producer([&cancelled] {
+    for (int i = 0; i < 100000 && cancelled.Push(i); ++i) {}
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  cancelled.Cancel();
+  producer.join();
+  cancelled.Wait();
+  EXPECT_LT(sunk.load(), 1000);
+}
+
+TEST(BlockingQueueTest, batch) {
+  BlockingQueue<int> queue(16);
+  std::vector<int> input(100);
+  std::iota(input.begin(), input.end(), 0);
+  std::thread producer([&queue, &input] {
+    EXPECT_EQ(queue.push_many(input.begin(), input.end()), 100);
+  });
+  std::vector<int> output;
+  while (output.size() < input.size()) {
+    EXPECT_GT(queue.pop_many(output, 10), 0);
+  }
+  producer.join();
+  EXPECT_EQ(output, input);
+
+  output.clear();
+  queue.push(1);
+  queue.push(2);
+  EXPECT_EQ(queue.drain(output), 2);
+  EXPECT_TRUE(queue.empty());
+  queue.push(3);
+  auto timeout = std::chrono::milliseconds(10);
+  EXPECT_EQ(queue.pop_many_for(output, 4, timeout), 1);
+  EXPECT_EQ(output, std::vector<int>({1, 2, 3}));
+  queue.abort();
+  EXPECT_EQ(queue.pop_many(output, 4), 0);
+}
+
+TEST(RingQueueTest, ring) {
+  RingQueue<int> queue(100);
+  EXPECT_EQ(queue.capacity(), 128);
+  for (int i = 0; i < 128; ++i) { EXPECT_TRUE(queue.try_push(i)); }
+  EXPECT_FALSE(queue.try_push(128));
+  EXPECT_TRUE(queue.full());
+  queue.clear();
+  EXPECT_TRUE(queue.empty());
+  // 不能默认构造的类型也可以clear和析构
+  int one = 1;
+  RingQueue<std::reference_wrapper<int>> refs(4);
+  EXPECT_TRUE(refs.try_push(std::ref(one)));
+  refs.clear();
+  EXPECT_TRUE(refs.empty());
+
+  const int num_items = 100000;
+  std::atomic<int64_t> sum{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; ++i) {
+    threads.emplace_back([&queue] {
+      for (int k = 1; k <= num_items; ++k) { queue.push(k); }
+    });
+    threads.emplace_back([&queue, &sum] {
+      int value = 0;
+      while (queue.pop(value)) { sum += value; }
+    });
+  }
+  threads[0].join();
+  threads[2].join();
+  while (!queue.empty()) { std::this_thread::yield(); }
+  queue.abort();
+  threads[1].join();
+  threads[3].join();
+  EXPECT_EQ(sum.load(), int64_t(num_items) * (num_items + 1));
+  EXPECT_FALSE(queue.push(1));
+}
+
 TEST(JsonTest, json) {
   Json::Value root;
   root["one"] = 1;
@@ -40,12 +620,339 @@ TEST(JsonTest, json) {
   }
 }
 
+TEST(JsonTest, json_lines) {
+  auto tempfile = boost::filesystem::unique_path().string();
+  {
+    JsonLinesWriter writer(tempfile, false, 64);
+    for (int i = 0; i < 1000; ++i) {
+      Json::Value record;
+      record["id"] = i;
+      record["text"] = "line\n" + std::to_string(i);
+      EXPECT_TRUE(writer.Write(record));
+    }
+  }
+  // 空行被跳过, 无法解析的行计入num_errors
+  {
+    std::ofstream outfile(tempfile, std::ios_base::app);
+    outfile << "\n{bad json\n{\"id\": 1000}";
+  }
+  for (bool use_mmap : {true, false}) {
+    JsonLinesReader reader(tempfile, use_mmap, 16);
+    ASSERT_TRUE(reader.is_open());
+    Json::Value record;
+    int count = 0;
+    while (reader.Next(record)) {
+      EXPECT_EQ(record["id"].asInt(), count);
+      ++count;
+    }
+    EXPECT_EQ(count, 1001);
+    EXPECT_EQ(reader.num_errors(), 1);
+    EXPECT_EQ(reader.line_number(), 1003);
+  }
+
+  ThreadPool pool(4);
+  std::vector<int> ids;
+  JsonLinesReader::ReadInBatches(
+      tempfile, pool,
+      [&ids](std::vector<Json::Value>& records) {
+        for (const auto& record : records) {
+          ids.push_back(record["id"].asInt());
+        }
+      },
+      1024);
+  std::vector<int> expected(1001);
+  std::iota(expected.begin(), expected.end(), 0);
+  EXPECT_EQ(ids, expected);
+  auto records = JsonLinesReader::ReadAll(tempfile, pool);
+  ASSERT_EQ(records.size(), 1001);
+  EXPECT_EQ(records[7]["text"].asString(), "line\n7");
+  boost::filesystem::remove(tempfile);
+}
+
+TEST(MD5Test, md5) {
+  const std::string content = "The quick brown fox jumps over the lazy dog";
+  EXPECT_EQ(CalcMD5(content), "9e107d9d372bb6826bd81d3542a419d6");
+  EXPECT_EQ(CalcMD5(""), "d41d8cd98f00b204e9800998ecf8427e");
+  MD5Hasher hasher;
+  hasher.Update(content.substr(0, 10));
+  hasher.Update(content.substr(10));
+  EXPECT_EQ(hasher.Finish(), CalcMD5(content));
+
+  auto tempfile = boost::filesystem::unique_path().string();
+  EXPECT_TRUE(WriteFile(tempfile, content));
+  EXPECT_EQ(CalcFileMD5(tempfile), CalcMD5(content));
+  ThreadPool pool(2);
+  auto results = CalcFileMD5({tempfile, "/nonexistent/file"}, pool);
+  EXPECT_EQ(results, std::vector<std::string>({CalcMD5(content), ""}));
+  // 在同一个pool的worker中调用, 所有worker都被占住时也不会死锁
+  ThreadPool single(1);
+  auto nested = single.enqueue([&single, &tempfile] {
+    return CalcFileMD5({tempfile, tempfile, tempfile}, single);
+  });
+  EXPECT_EQ(nested.get(), std::vector<std::string>(3, CalcMD5(content)));
+  if (boost::filesystem::exists(tempfile)) {
+    boost::filesystem::remove(tempfile);
+  }
+}
+
+TEST(TimerTest, clock) {
+  TscTimer timer;
+  timer.Start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  // sleep只保证下限, 繁忙的机器上可能多睡很久
+  auto ms = timer.MilliSeconds();
+  EXPECT_GE(ms, 20.0F);
+  EXPECT_LT(ms, 1000.0F);
+  auto first = TscClock::now();
+  auto second = TscClock::now();
+  EXPECT_LE(first, second);
+  auto steady = std::chrono::steady_clock::now().time_since_epoch();
+  auto drift = second.time_since_epoch() - steady;
+  EXPECT_LT(std::abs(drift.count()), 1000000);
+  // 旧代码中的Timer::SystemClock仍然可用
+  auto wall = Timer::SystemClock::now();
+  EXPECT_GT(wall.time_since_epoch().count(), 0);
+}
+
+// 手动推进的时钟, 用于测试依赖时间的统计
+struct ManualClock {
+  using rep = int64_t;
+  using period = std::nano;
+  using duration = std::chrono::nanoseconds;
+  using time_point = std::chrono::time_point<ManualClock>;
+  static constexpr bool is_steady = true;
+  static time_point now() { return time_point(current); }
+  static inline duration current{0};
+};
+
+TEST(RateMeterTest, rate) {
+  using Meter = BasicRateMeter<ManualClock>;
+  Meter meter;
+  ThreadPool pool(4);
+  ParallelFor(pool, 0, 1000, [&meter](int64_t) { meter.Mark(); });
+  EXPECT_EQ(meter.count(), 1000);
+  EXPECT_EQ(meter.Rate(Meter::kLastInterval), 0.0);
+
+  ManualClock::current += std::chrono::seconds(2);
+  EXPECT_DOUBLE_EQ(meter.Rate(Meter::kLastInterval), 500.0);
+  EXPECT_DOUBLE_EQ(meter.Rate(Meter::k1Minute), 500.0);
+  // 之后一分钟没有事件, 1分钟窗口衰减到1/e, 15分钟窗口变化不大
+  ManualClock::current += std::chrono::seconds(60);
+  meter.Mark(0);
+  auto root = meter.ToJson();
+  EXPECT_EQ(root["count"].asInt64(), 1000);
+  EXPECT_DOUBLE_EQ(root["rate_last"].asDouble(), 0.0);
+  EXPECT_NEAR(root["rate_1m"].asDouble(), 500.0 / M_E, 1e-6);
+  EXPECT_GT(root["rate_15m"].asDouble(), 450.0);
+  EXPECT_NEAR(root["mean_rate"].asDouble(), 1000.0 / 62.0, 1e-6);
+
+  meter.Reset();
+  EXPECT_EQ(meter.count(), 0);
+  EXPECT_EQ(meter.MeanRate(), 0.0);
+}
+
+TEST(LatencyHistogramTest, histogram) {
+  for (int64_t value : {0, 31, 32, 63, 64, 1000, 123456789}) {
+    int index = LatencyHistogram::BucketIndex(value);
+    EXPECT_GE(LatencyHistogram::BucketUpperBound(index), value);
+    EXPECT_LE(LatencyHistogram::BucketUpperBound(index), value * 33 / 32 + 1);
+  }
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Percentile(50), -1);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&histogram] {
+      for (int k = 1; k <= 1000; ++k) { histogram.Record(k * 1000); }
+    });
+  }
+  for (auto& thread : threads) { thread.join(); }
+  EXPECT_EQ(histogram.count(), 4000);
+  EXPECT_NEAR(histogram.Percentile(50), 500000, 500000 / 32);
+  EXPECT_NEAR(histogram.Percentile(99), 990000, 990000 / 32);
+  EXPECT_NEAR(histogram.Mean(), 500500, 1);
+
+  LatencyHistogram other;
+  {
+    ScopedLatencyTimer timer(other);
+  }
+  histogram.Merge(other);
+  EXPECT_EQ(histogram.count(), 4001);
+  auto json = histogram.ToJson();
+  EXPECT_EQ(json["count"].asInt64(), 4001);
+  EXPECT_GT(json["p999_us"].asDouble(), json["p50_us"].asDouble());
+  histogram.Reset();
+  EXPECT_EQ(histogram.count(), 0);
+}
+
+TEST(TraceTest, trace) {
+  {
+    TRACE_SCOPE("disabled");
+  }
+  auto tempfile = boost::filesystem::unique_path().string();
+  auto& tracer = Tracer::Instance();
+  // 父目录是普通文件, 无法写入
+  ASSERT_TRUE(WriteFile(tempfile, std::string()));
+  EXPECT_FALSE(tracer.Start(tempfile + "/trace.json"));
+  EXPECT_FALSE(Tracer::enabled());
+  EXPECT_TRUE(tracer.Start(tempfile));
+  EXPECT_FALSE(tracer.Start(tempfile));
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; ++i) {
+    threads.emplace_back([] {
+      TRACE_SCOPE("outer");
+      {
+        TRACE_SCOPE("inner");
+      }
+    });
+  }
+  for (auto& thread : threads) { thread.join(); }
+  tracer.Stop();
+
+  // 文件末尾没有']', 补全之后才是合法的json
+  auto content = ReadFile(tempfile);
+  content = content.substr(0, content.rfind(',')) + "]";
+  auto events = ParseJsonString(content);
+  EXPECT_EQ(events.size(), 4);
+  std::map<std::string, int> names;
+  for (const auto& event : events) {
+    names[event["name"].asString()] += 1;
+    EXPECT_EQ(event["ph"].asString(), "X");
+    EXPECT_GE(event["dur"].asDouble(), 0.0);
+  }
+  EXPECT_EQ(names["outer"], 2);
+  EXPECT_EQ(names["inner"], 2);
+
+  // 已经退出的线程的缓冲区在事件取走之后被释放
+  EXPECT_TRUE(tracer.Start(tempfile, std::chrono::hours(1)));
+  std::thread([] { TRACE_SCOPE("exited"); }).join();
+  int before = tracer.num_buffers();
+  EXPECT_EQ(tracer.Collect().size(), 1);
+  EXPECT_EQ(tracer.Collect().size(), 0);
+  EXPECT_LT(tracer.num_buffers(), before);
+  tracer.Stop();
+  if (boost::filesystem::exists(tempfile)) {
+    boost::filesystem::remove(tempfile);
+  }
+}
+
+TEST(SubprocessTest, subprocess) {
+  auto result = Subprocess::Run({"sh", "-c", "echo out; echo err >&2; exit 3"});
+  EXPECT_TRUE(result.started);
+  EXPECT_EQ(result.exit_code, 3);
+  EXPECT_EQ(result.out, "out\n");
+  EXPECT_EQ(result.err, "err\n");
+
+  // 默认stdin为/dev/null, ExecShell与popen一样继承当前进程的stdin
+  const std::vector<std::string> show_stdin = {"readlink", "/proc/self/fd/0"};
+  EXPECT_EQ(Subprocess::Run(show_stdin).out, "/dev/null\n");
+  auto own_stdin = boost::filesystem::read_symlink("/proc/self/fd/0");
+  EXPECT_EQ(ExecShell("readlink /proc/self/fd/0"), own_stdin.string() + "\n");
+
+  // 大量输出不会因为管道写满而卡住
+  result = Subprocess::Run({"head", "-c", "1000000", "/dev/zero"});
+  EXPECT_TRUE(result.ok());
+  EXPECT_EQ(result.out.size(), 1000000);
+
+  Subprocess::Options options;
+  options.timeout = std::chrono::milliseconds(100);
+  Timer timer;
+  timer.Start();
+  result = Subprocess::Run({"sleep", "10"}, options);
+  EXPECT_TRUE(result.timed_out);
+  EXPECT_EQ(result.signal, SIGKILL);
+  EXPECT_LT(timer.MilliSeconds(), 5000);
+
+  Subprocess process({"sleep", "10"});
+  ASSERT_TRUE(process.Start());
+  process.Kill(SIGTERM);
+  EXPECT_EQ(process.Wait().signal, SIGTERM);
+
+  EXPECT_FALSE(Subprocess::Run({"/nonexistent/command"}).started);
+  EXPECT_EQ(ExecShell("echo hello | tr a-z A-Z"), "HELLO\n");
+
+  ThreadPool pool(2);
+  std::vector<std::vector<std::string>> commands;
+  for (int i = 0; i < 20; ++i) {
+    commands.push_back({"echo", std::to_string(i)});
+  }
+  auto results = Subprocess::RunAll(commands, pool, Subprocess::Options(), 3);
+  ASSERT_EQ(results.size(), 20);
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(results[i].out, std::to_string(i) + "\n");
+  }
+}
+
 TEST(DateTimeTest, datetime) {
   auto dt = DateTime().seconds();
   auto dt2 = DateTime(dt.string());
   EXPECT_TRUE(dt.value == dt2.value);
 }
 
+TEST(DateTimeTest, format) {
+  // 与strftime比较, 覆盖闰年, 世纪年和1970年之前的时间
+  std::vector<DateTime> values;
+  for (int64_t t = -2208988800LL; t < 4102444800LL; t += 7776000 + 3601) {
+    values.emplace_back(DateTime::TimePoint(std::chrono::seconds(t)));
+  }
+  values.emplace_back(DateTime::TimePoint(std::chrono::seconds(951825600)));
+  auto column = DateTime::FormatColumn(values);
+  ASSERT_EQ(column.size(), values.size() * (DateTime::kStringSize + 1));
+  for (size_t i = 0; i < values.size(); ++i) {
+    auto t = DateTime::SystemClock::to_time_t(values[i].value);
+    std::tm tm = {};
+    localtime_r(&t, &tm);
+    char expected[32];
+    std::strftime(expected, sizeof(expected), "%Y-%m-%d %H:%M:%S", &tm);
+    auto text = values[i].string();
+    EXPECT_EQ(text.substr(0, 19), expected);
+    EXPECT_EQ(column.substr(i * (DateTime::kStringSize + 1),
+                            DateTime::kStringSize),
+              text);
+    EXPECT_EQ(DateTime(text).value, values[i].value);
+  }
+
+  DateTime now;
+  EXPECT_EQ(DateTime(now.string()).value, now.value);
+  DateTime parsed(DateTime::TimePoint{});
+  EXPECT_TRUE(DateTime::Parse("2021-08-02 23:15:34.5", parsed));
+  EXPECT_EQ(parsed.string().substr(19, 3), ".50");
+  EXPECT_EQ(parsed.seconds().value, DateTime("2021-08-02 23:15:34").value);
+  for (auto bad : {"2021-02-29 00:00:00", "2021-08-02 24:00:00",
+                   "2021-08-02T23:15:34", "2021-08-02 23:15:34.", "2021-8-2"}) {
+    EXPECT_FALSE(DateTime::Parse(bad, parsed)) << bad;
+  }
+  // 非固定宽度的格式仍然由date库解析
+  EXPECT_EQ(DateTime("2021-8-2 3:05:09").value,
+            DateTime("2021-08-02 03:05:09").value);
+}
+
+TEST(FormatTest, format) {
+  EXPECT_EQ(ToString(std::vector<int>{1, -2, 3}), "[1, -2, 3]");
+  EXPECT_EQ(ToString(std::vector<char>{1, 2}), "[1, 2]");
+  EXPECT_EQ(ToString(std::vector<double>{0.1, 1.0, 1.115, -2.5}),
+            (boost::format("[%.2f, %.2f, %.2f, %.2f]") % 0.1 % 1.0 % 1.115 %
+             -2.5).str());
+  EXPECT_EQ(ToString(1.112F), "1.11");
+  EXPECT_EQ(ToString(int64_t(1) << 40), "1099511627776");
+  EXPECT_EQ(ToString(std::vector<std::string>{"a", "b"}), "[a, b]");
+  EXPECT_EQ(ToString(std::vector<std::vector<int>>{{1, 2}, {}, {3}}),
+            "[[1, 2], [], [3]]");
+  EXPECT_EQ(ToString(std::make_pair(std::string("one"), 1.0)), "(one, 1.00)");
+  std::map<std::string, std::vector<int>> map = {{"a", {1}}, {"b", {2, 3}}};
+  EXPECT_EQ(ToString(map), "{a: [1], b: [2, 3]}");
+  EXPECT_EQ(ToString(1e300).size(), 304);
+
+  std::string buffer;
+  AppendString(buffer, "bytes: ");
+  AppendBytesString(buffer, 1536);
+  EXPECT_EQ(buffer, "bytes: 1.50 KB");
+  buffer.clear();
+  AppendSecondsString(buffer, 90);
+  EXPECT_EQ(buffer, "1.50 min");
+  auto converter = [](int v) { return std::to_string(v * 2); };
+  EXPECT_EQ(ToString(std::vector<int>{1, 2}, converter), "[2, 4]");
+}
+
 TEST(BytesTest, bytes) {
   EXPECT_EQ(GetBytesByString("512K"), GetBytesByString("0.5MB"));
   EXPECT_EQ(GetBytesByString("1024K"), GetBytesByString("1MB"));